@@ -16,15 +16,39 @@
 #include <chrono>
 #include <thread>
 #include <map>
+#include <unordered_map>
 #include <random>
 #include <cctype>
 #include <cstdlib>
-#include <regex>
+#include <bitset>
+#include <optional>
+#include <stdexcept>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
 #include <cstring>   // <<-- fixed: strlen, memset, etc.
+#include <cerrno>
+#include <string_view>
+#include <cstdint>
+#include <charconv>
+#include <memory>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
 
 #ifdef _WIN32
   #include <windows.h>
   #include <shellapi.h>
+  #include <io.h>
+  #include <fcntl.h>
+  #include <csignal>
   #define popen _popen
   #define pclose _pclose
   #define PLATFORM "Windows"
@@ -34,6 +58,18 @@
   #include <sys/types.h>
   #include <pwd.h>
   #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <signal.h>
+  #ifdef __linux__
+    #include <sys/sendfile.h>
+    #include <sys/inotify.h>
+    #include <sys/syscall.h>
+    #include <linux/fs.h>   // FICLONE
+  #endif
+  #include <dirent.h>
+  #include <sys/mman.h>
+  #include <sys/ioctl.h>
   #define PLATFORM "POSIX"
 #endif
 
@@ -44,6 +80,7 @@ namespace fs = std::filesystem;
 static vector<string> history_buf;
 static map<string,string> alias_map;
 static map<string,string> bookmarks;
+static bool quit_requested = false;
 
 // -- Mint-inspired palette & helpers ------------------------------------
 enum class MTColor {
@@ -61,7 +98,7 @@ enum class MTColor {
     GRAY
 };
 
-static string mt_code(MTColor c) {
+static constexpr string_view mt_code(MTColor c) {
 #ifdef _WIN32
     // We'll still return ANSI codes; enable VT on startup
 #endif
@@ -82,6 +119,18 @@ static string mt_code(MTColor c) {
     }
 }
 
+// Escapes are only emitted to terminals; set from isatty() in main().
+static bool color_stdout = true;
+static bool color_stderr = true;
+
+static bool fd_is_tty(int fd) {
+#ifdef _WIN32
+    return _isatty(fd) != 0;
+#else
+    return isatty(fd) != 0;
+#endif
+}
+
 static void enable_ansi_on_windows() {
 #ifdef _WIN32
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -93,11 +142,66 @@ static void enable_ansi_on_windows() {
 #endif
 }
 
-static string colorize(MTColor c, const string &s) {
-    return mt_code(c) + s + mt_code(MTColor::RESET);
+static string colorize(MTColor c, string_view s, bool enabled) {
+    string r;
+    if (!enabled) return r.assign(s);
+    r.reserve(s.size() + 16);
+    r.append(mt_code(c)).append(s).append(mt_code(MTColor::RESET));
+    return r;
 }
+static string colorize(MTColor c, string_view s) { return colorize(c, s, color_stdout); }
 static void print_colored(MTColor c, const string &s) { cout << colorize(c, s); }
-static void eprint_colored(MTColor c, const string &s) { cerr << colorize(c, s); }
+static void eprint_colored(MTColor c, const string &s) { cerr << colorize(c, s, color_stderr); }
+
+// -- buffered output sink --------------------------------------------------
+// Hot builtins write through `out` instead of cout: fragments land in one
+// reusable buffer that is handed to cout in large blocks. The dispatcher
+// flushes it after every command, so builtins need not, but a builtin must not
+// mix `out` and cout without flushing in between.
+class OutSink {
+public:
+    explicit OutSink(size_t cap) : buf_(new char[cap]), cap_(cap) {}
+
+    OutSink &write(const char *p, size_t n) {
+        if (len_ + n > cap_) {
+            flush_buffer();
+            if (n >= cap_) { cout.write(p, static_cast<streamsize>(n)); return *this; }
+        }
+        memcpy(buf_.get() + len_, p, n); len_ += n;
+        return *this;
+    }
+    OutSink &operator<<(string_view s) { return write(s.data(), s.size()); }
+    OutSink &operator<<(char c) {
+        if (len_ == cap_) flush_buffer();
+        buf_[len_++] = c;
+        return *this;
+    }
+    template <typename T, typename = enable_if_t<is_integral_v<T> && !is_same_v<T, char>>>
+    OutSink &operator<<(T v) {
+        char tmp[24]; auto r = to_chars(tmp, tmp + sizeof(tmp), v);
+        return write(tmp, static_cast<size_t>(r.ptr - tmp));
+    }
+    // right-aligned integer, like setw(width)
+    OutSink &pad(uintmax_t v, int width) {
+        char tmp[24]; auto r = to_chars(tmp, tmp + sizeof(tmp), v);
+        for (int n = static_cast<int>(r.ptr - tmp); n < width; ++n) *this << ' ';
+        return write(tmp, static_cast<size_t>(r.ptr - tmp));
+    }
+    OutSink &color(MTColor c) { if (color_stdout) *this << mt_code(c); return *this; }
+    OutSink &colored(MTColor c, string_view s) { color(c) << s; return color(MTColor::RESET); }
+
+    void flush() { flush_buffer(); cout.flush(); }
+
+private:
+    void flush_buffer() {
+        if (len_) cout.write(buf_.get(), static_cast<streamsize>(len_));
+        len_ = 0;
+    }
+    unique_ptr<char[]> buf_;
+    size_t cap_;
+    size_t len_ = 0;
+};
+static OutSink out(1 << 16);
 
 // -- small helpers ---------------------------------------------------------
 static vector<string> split_args(const string &s) {
@@ -122,6 +226,22 @@ static vector<string> split_args(const string &s) {
     return out;
 }
 
+// 64-bit hash, eight bytes per step; only needs to spread lines over the table.
+static uint64_t hash_bytes(const char *p, size_t n) {
+    const uint64_t K = 0x9E3779B97F4A7C15ull;
+    uint64_t h = n * K;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w; memcpy(&w, p, 8);
+        h = (h ^ w) * K; h ^= h >> 29;
+    }
+    if (n) {
+        uint64_t w = 0; memcpy(&w, p, n);
+        h = (h ^ w) * K; h ^= h >> 29;
+    }
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 32);
+}
+
 static bool is_executable_file(const fs::path &p) {
 #ifdef _WIN32
     string ext = p.has_extension() ? p.extension().string() : string();
@@ -148,196 +268,2403 @@ static string perms_to_string(fs::perms p) {
     return s;
 }
 
+static string time_string(time_t tt) {
+    char buf[64]; strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&tt));
+    return string(buf);
+}
+
 static string file_time_string(const fs::file_time_type &ft) {
     using namespace std::chrono;
     auto sctp = time_point_cast<system_clock::duration>(ft - fs::file_time_type::clock::now()
                     + system_clock::now());
-    time_t tt = system_clock::to_time_t(sctp);
-    char buf[64]; strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&tt));
-    return string(buf);
+    return time_string(system_clock::to_time_t(sctp));
 }
 
-// -- core commands ---------------------------------------------------------
+// -- line reader -----------------------------------------------------------
+// Reads a file in large blocks with plain read() and hands out lines as
+// string_views into its own buffer; a view stays valid until the next call.
+// Newlines are located with memchr, which libc vectorizes. Shared by all the
+// text builtins instead of per-command ifstream/getline loops.
+class LineReader {
+public:
+    explicit LineReader(const string &path, size_t block = 1 << 20)
+        : buf_(new char[block]), cap_(block) {
+#ifdef _WIN32
+        fd_ = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  #ifdef POSIX_FADV_SEQUENTIAL
+        if (fd_ >= 0) posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+  #endif
+#endif
+        if (fd_ < 0) err_ = errno;
+    }
+    ~LineReader() {
+#ifdef _WIN32
+        if (fd_ >= 0) _close(fd_);
+#else
+        if (fd_ >= 0) ::close(fd_);
+#endif
+    }
+    LineReader(const LineReader&) = delete;
+    LineReader &operator=(const LineReader&) = delete;
 
-static void cmd_help() {
-    print_colored(MTColor::CYAN, "Commands (Mint look):\n");
-    cout <<
-    "  help, exit, quit           - this message / quit\n"
-    "  ls [dir]                   - list directory\n"
-    "  ls -l [dir]                - long listing (permissions, size, mtime)\n"
-    "  pwd                        - print working dir\n"
-    "  cd <dir>                   - change dir\n"
-    "  cat <file>                 - show file\n"
-    "  edit <file>                - open file with $EDITOR/code/nano\n"
-    "  echo <text>                - print text\n"
-    "  history                    - show command history\n"
-    "  history -c                 - clear history\n"
-    "  grep <pat> <file>          - search for pattern in file\n"
-    "  wc <file>                  - count lines/words/chars\n"
-    "  head <file>                - first 10 lines\n"
-    "  tail <file>                - last 10 lines\n"
-    "  tail -f <file>             - follow appended writes (Ctrl-C to stop)\n"
-    "  chmod <octal> <file>       - change permissions (e.g. 755)\n"
-    "  ln <target> <link>         - create symbolic link\n"
-    "  du [dir]                   - disk usage (simple)\n"
-    "  sort <file>                - sort file lines\n"
-    "  uniq <file>                - unique adjacent lines\n"
-    "  tree [dir]                 - tree view (simple)\n"
-    "  ps                         - process list\n"
-    "  df                         - disk/free info\n"
-    "  whoami                     - current user\n"
-    "  date                       - show date/time\n"
-    "  clear                      - clear screen\n"
-    "  which <cmd>                - find executable in PATH\n"
-    "  open <file>                - open with default application\n"
-    "  env                        - show environment variables\n"
-    "  setenv NAME VALUE          - set environment variable\n"
-    "  stat <file>                - show file metadata\n"
-    "  count [dir]                - count files and directories (recursive)\n"
-    "  alias name='command'       - create alias\n"
-    "  unalias name               - remove alias\n"
-    "  aliases                    - list aliases\n"
-    "  bookmark <name>            - save cwd under <name>\n"
-    "  bookmarks                  - list bookmarks\n"
-    "  goto <name>                - cd to bookmark\n"
-    "  replace <file> <old> <new> - in-file simple replace (creates .bak)\n"
-    "  uptime                     - show system uptime\n"
-    "  ping <host> [-c N]         - wrapper around system ping\n"
-    "  hash <file>                - show SHA-256 (system tool)\n"
-    "  compress <file> <out.zip>  - wrapper to create archive\n"
-    "  extract <archive>          - extract archive (unzip/tar)\n"
-    "  top                        - launch top/htop/taskmgr\n"
-    "  net                        - show network interfaces (ip/ipconfig)\n"
-    "  notify <message>           - desktop notification (Linux)\n"
-    "  calc \"expr\"               - simple calculator (+ - * / parentheses)\n"
-    "  random [min] [max] [count] - generate integers\n";
-}
+    bool ok() const { return fd_ >= 0; }
+    // errno of a failed open or read (EISDIR, EIO, ...), 0 if none. A read
+    // error ends the input like EOF does, so callers check this afterwards.
+    int error() const { return err_; }
 
-static void cmd_ls(const vector<string>& a) {
-    string p = ".";
-    bool longlist = false;
-    if (a.size() > 1) {
-        if (a[1] == "-l") { longlist = true; if (a.size() > 2) p = a[2]; }
-        else p = a[1];
+    // Next line without its '\n'; a final unterminated line is returned too.
+    bool next(string_view &line) {
+        for (;;) {
+            if (const char *nl = static_cast<const char*>(memchr(buf_.get() + scan_, '\n', end_ - scan_))) {
+                line = string_view(buf_.get() + beg_, static_cast<size_t>(nl - (buf_.get() + beg_)));
+                beg_ = scan_ = static_cast<size_t>(nl - buf_.get()) + 1;
+                return true;
+            }
+            scan_ = end_;
+            if (!fill()) {
+                if (beg_ == end_) return false;
+                line = string_view(buf_.get() + beg_, end_ - beg_);
+                beg_ = scan_ = end_;
+                return true;
+            }
+        }
     }
-    try {
-        vector<fs::directory_entry> ents;
-        for (auto &e : fs::directory_iterator(p)) ents.push_back(e);
-        sort(ents.begin(), ents.end(), [](auto &A, auto &B){
-            return A.path().filename().string() < B.path().filename().string();
-        });
-        for (auto &e : ents) {
-            string name = e.path().filename().string();
-            if (longlist) {
-                fs::file_status st = e.status();
-                string perms = perms_to_string(st.permissions());
-                uintmax_t sz = 0;
-                try { if (fs::is_regular_file(e)) sz = fs::file_size(e); } catch(...) {}
-                string mtime = file_time_string(fs::last_write_time(e));
-                // print perms (gray), size (orange), mtime(gray)
-                cout << colorize(MTColor::GRAY, perms + " ");
-                {
-                    ostringstream oss;
-                    oss << setw(8) << sz;
-                    cout << colorize(MTColor::ORANGE, oss.str()) << " ";
-                }
-                cout << colorize(MTColor::GRAY, mtime) << " ";
+
+    // Next run of whole lines, '\n' included (only the last chunk of a file
+    // may end without one). Lets callers scan many lines per call.
+    bool next_chunk(string_view &chunk) {
+        for (;;) {
+            size_t last = end_;
+            while (last > scan_ && buf_[last - 1] != '\n') --last;
+            if (last > scan_) {
+                chunk = string_view(buf_.get() + beg_, last - beg_);
+                beg_ = scan_ = last;
+                return true;
+            }
+            scan_ = end_;
+            if (!fill()) {
+                if (beg_ == end_) return false;
+                chunk = string_view(buf_.get() + beg_, end_ - beg_);
+                beg_ = scan_ = end_;
+                return true;
             }
-            if (fs::is_directory(e)) cout << colorize(MTColor::BLUE, name) << '\n';
-            else if (fs::is_symlink(e)) cout << colorize(MTColor::MAGENTA, name) << '\n';
-            else if (is_executable_file(e.path())) cout << colorize(MTColor::BRIGHT_GREEN, name) << '\n';
-            else cout << name << '\n';
         }
-    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("ls: ") + ex.what() + "\n"); }
-}
+    }
 
-static void cmd_pwd() {
-    try { cout << colorize(MTColor::MINT_GREEN, fs::current_path().string()) << '\n'; } catch(...) { eprint_colored(MTColor::RED, "?\n"); }
-}
+    // The buffered, unconsumed bytes (reading the first block if needed),
+    // without consuming them.
+    string_view peek() {
+        if (beg_ == end_) fill();
+        return string_view(buf_.get() + beg_, end_ - beg_);
+    }
 
-static void cmd_cd(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "cd: missing arg\n"); return; }
-    try { fs::current_path(a[1]); } catch (const exception &ex) { eprint_colored(MTColor::RED, string("cd: ") + ex.what() + '\n'); }
-}
+    // Next block of raw bytes, ignoring line boundaries.
+    bool next_block(string_view &blk) {
+        if (beg_ == end_ && !fill()) return false;
+        blk = string_view(buf_.get() + beg_, end_ - beg_);
+        beg_ = scan_ = end_;
+        return true;
+    }
 
-static void cmd_cat(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "cat: missing file\n"); return; }
-    ifstream f(a[1]); if (!f) { eprint_colored(MTColor::RED, "cat: cannot open\n"); return; }
-    string line; while (getline(f, line)) cout << line << '\n';
-}
+private:
+    // Appends more data after the unconsumed tail; false at EOF or error.
+    bool fill() {
+        if (eof_ || fd_ < 0) return false;
+        if (beg_ == end_) { beg_ = end_ = scan_ = 0; }
+        else if (beg_ > 0) {
+            memmove(buf_.get(), buf_.get() + beg_, end_ - beg_);
+            end_ -= beg_; scan_ -= beg_; beg_ = 0;
+        }
+        if (end_ == cap_) {  // one line longer than the buffer: grow
+            unique_ptr<char[]> bigger(new char[cap_ * 2]);
+            memcpy(bigger.get(), buf_.get(), end_);
+            buf_ = move(bigger); cap_ *= 2;
+        }
+        for (;;) {
+#ifdef _WIN32
+            int n = _read(fd_, buf_.get() + end_, static_cast<unsigned>(cap_ - end_));
+#else
+            ssize_t n = ::read(fd_, buf_.get() + end_, cap_ - end_);
+            if (n < 0 && errno == EINTR) continue;
+#endif
+            if (n <= 0) { if (n < 0) err_ = errno; eof_ = true; return false; }
+            end_ += static_cast<size_t>(n);
+            return true;
+        }
+    }
 
-static void cmd_edit(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "edit: missing file\n"); return; }
-    string file = a[1];
-    const char* ed = getenv("EDITOR");
-    string cmd;
-    if (ed && strlen(ed)) cmd = string(ed) + " \"" + file + "\"";
-    else {
-        // try code, nano
-        if (system("command -v code >/dev/null 2>&1") == 0) cmd = "code \"" + file + "\"";
-        else cmd = "nano \"" + file + "\"";
+    unique_ptr<char[]> buf_;
+    size_t cap_;
+    size_t beg_ = 0, scan_ = 0, end_ = 0;
+    int fd_ = -1;
+    int err_ = 0;
+    bool eof_ = false;
+};
+
+#ifndef _WIN32
+// -- raw fd I/O ------------------------------------------------------------
+static bool write_all(int fd, const char *p, size_t n) {
+    while (n) {
+        ssize_t w = ::write(fd, p, n);
+        if (w < 0) { if (errno == EINTR) continue; return false; }
+        p += w; n -= static_cast<size_t>(w);
     }
-    system(cmd.c_str());
+    return true;
 }
 
-static void cmd_mkdir(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "mkdir: missing dir\n"); return; }
-    try {
-        if (a.size() > 1 && a[1] == "-p") {
-            if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "mkdir -p: missing path\n"); return; }
-            fs::create_directories(a[2]);
-            cout << "created\n";
-        } else {
-            if (fs::create_directory(a[1])) cout << "created\n"; else eprint_colored(MTColor::RED, "mkdir: failed\n");
+// Streams in_fd (from its current offset) to out_fd. Off a terminal the copy
+// stays in the kernel: copy_file_range between regular files, sendfile (which
+// splices into pipes) otherwise. Terminals and anything the kernel refuses
+// get a large-buffer read/write loop.
+static bool copy_fd(int in_fd, int out_fd, bool out_is_tty) {
+#ifdef __linux__
+    if (!out_is_tty) {
+        struct stat ist, ost;
+        bool reg = fstat(in_fd, &ist) == 0 && fstat(out_fd, &ost) == 0 && S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode);
+        bool kernel_ok = true;
+        while (reg) {
+            ssize_t n = copy_file_range(in_fd, nullptr, out_fd, nullptr, size_t(1) << 30, 0);
+            if (n > 0) continue;
+            if (n == 0) return true;
+            if (errno == EINTR) continue;
+            if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) return false;
+            break;
         }
-    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("mkdir: ") + ex.what() + '\n'); }
+        while (kernel_ok) {
+            ssize_t n = sendfile(out_fd, in_fd, nullptr, size_t(1) << 30);
+            if (n > 0) continue;
+            if (n == 0) return true;
+            if (errno == EINTR) continue;
+            if (errno != EINVAL && errno != ENOSYS && errno != EAGAIN) return false;
+            kernel_ok = false;
+        }
+    }
+#endif
+    const size_t cap = 1 << 17;
+    unique_ptr<char[]> buf(new char[cap]);
+    for (;;) {
+        ssize_t n = ::read(in_fd, buf.get(), cap);
+        if (n < 0) { if (errno == EINTR) continue; return false; }
+        if (n == 0) return true;
+        if (!write_all(out_fd, buf.get(), static_cast<size_t>(n))) return false;
+    }
 }
+#endif
 
-static void cmd_rm(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "rm: missing file\n"); return; }
-    try { if (fs::remove(a[1])) cout << "removed\n"; else eprint_colored(MTColor::RED, "rm: failed\n"); }
-    catch (const exception &ex) { eprint_colored(MTColor::RED, string("rm: ") + ex.what() + '\n'); }
+// -- SIMD kernels ----------------------------------------------------------
+// x86-64 always has SSE2; AVX2 variants are compiled with a target attribute
+// and picked at runtime, so a plain build still uses them where available.
+// Other targets take the scalar paths.
+#if defined(__GNUC__) && defined(__x86_64__)
+  #define CT_X86_SIMD 1
+  #define CT_TARGET_AVX2 __attribute__((target("avx2")))
+static bool cpu_has_avx2() {
+    static const bool v = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+    return v;
 }
+#elif defined(_MSC_VER) && defined(_M_X64)
+  #define CT_X86_SIMD 1
+  #define CT_TARGET_AVX2
+static bool cpu_has_avx2() { return false; }
+#endif
 
-static void cmd_rmdir(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "rmdir: missing dir\n"); return; }
-    try { uintmax_t n = fs::remove_all(a[1]); cout << "removed " << n << " entries\n"; }
-    catch (const exception &ex) { eprint_colored(MTColor::RED, string("rmdir: ") + ex.what() + '\n'); }
+static inline unsigned ctz32(uint32_t v) {
+#ifdef _MSC_VER
+    unsigned long i; _BitScanForward(&i, v); return static_cast<unsigned>(i);
+#else
+    return static_cast<unsigned>(__builtin_ctz(v));
+#endif
+}
+static inline unsigned popcnt32(uint32_t v) {
+#ifdef _MSC_VER
+    return __popcnt(v);
+#else
+    return static_cast<unsigned>(__builtin_popcount(v));
+#endif
 }
 
-static void cmd_touch(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "touch: missing file\n"); return; }
-    ofstream f(a[1], ios::app); if (!f) eprint_colored(MTColor::RED, "touch: cannot create\n");
+#ifdef CT_X86_SIMD
+CT_TARGET_AVX2 static size_t count_byte_avx2(const char *p, size_t n, char c) {
+    const __m256i C = _mm256_set1_epi8(c);
+    size_t cnt = 0, i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        cnt += popcnt32(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, C))));
+    }
+    for (; i < n; ++i) cnt += p[i] == c;
+    return cnt;
 }
+#endif
 
-static void cmd_cp(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "cp: usage cp <src> <dst>\n"); return; }
-    try { fs::copy(a[1], a[2], fs::copy_options::recursive | fs::copy_options::overwrite_existing); cout << "copied\n"; }
-    catch (const exception &ex) { eprint_colored(MTColor::RED, string("cp: ") + ex.what() + '\n'); }
+// Number of occurrences of `c` in [p, p+n); used for newline counting.
+static size_t count_byte(const char *p, size_t n, char c) {
+    size_t cnt = 0, i = 0;
+#ifdef CT_X86_SIMD
+    if (cpu_has_avx2()) return count_byte_avx2(p, n, c);
+    const __m128i C = _mm_set1_epi8(c);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        cnt += popcnt32(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, C))));
+    }
+#endif
+    for (; i < n; ++i) cnt += p[i] == c;
+    return cnt;
 }
 
-static void cmd_mv(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "mv: usage mv <src> <dst>\n"); return; }
-    try { fs::rename(a[1], a[2]); cout << "moved\n"; }
-    catch (const exception &ex) { eprint_colored(MTColor::RED, string("mv: ") + ex.what() + '\n'); }
+struct WcCounts { uintmax_t lines = 0, words = 0, bytes = 0; };
+
+// Lines and words in one block. A word starts at every non-space byte whose
+// predecessor is whitespace (C-locale isspace); `prev_space` carries that
+// state across blocks. The SIMD paths build a whitespace bitmask per 16/32
+// bytes and count word starts as popcount(~ws & (ws << 1 | carry)).
+#ifdef CT_X86_SIMD
+CT_TARGET_AVX2 static size_t wc_block_avx2(const char *p, size_t n, bool &prev_space, WcCounts &c) {
+    const __m256i NL = _mm256_set1_epi8('\n'), SP = _mm256_set1_epi8(' ');
+    const __m256i NINE = _mm256_set1_epi8(9), FOUR = _mm256_set1_epi8(4);
+    uint64_t carry = prev_space;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i t = _mm256_sub_epi8(v, NINE);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, SP), _mm256_cmpeq_epi8(_mm256_min_epu8(t, FOUR), t));
+        uint64_t wm = static_cast<uint32_t>(_mm256_movemask_epi8(ws));
+        c.lines += popcnt32(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, NL))));
+        c.words += popcnt32(static_cast<uint32_t>(~wm & ((wm << 1) | carry)));
+        carry = wm >> 31;
+    }
+    prev_space = carry != 0;
+    return i;
+}
+#endif
+
+static void wc_block(const char *p, size_t n, bool &prev_space, WcCounts &c) {
+    size_t i = 0;
+#ifdef CT_X86_SIMD
+    if (cpu_has_avx2()) i = wc_block_avx2(p, n, prev_space, c);
+    else {
+        const __m128i NL = _mm_set1_epi8('\n'), SP = _mm_set1_epi8(' ');
+        const __m128i NINE = _mm_set1_epi8(9), FOUR = _mm_set1_epi8(4);
+        uint32_t carry = prev_space;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i t = _mm_sub_epi8(v, NINE);
+            __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, SP), _mm_cmpeq_epi8(_mm_min_epu8(t, FOUR), t));
+            uint32_t wm = static_cast<uint32_t>(_mm_movemask_epi8(ws));
+            c.lines += popcnt32(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, NL))));
+            c.words += popcnt32(~wm & ((wm << 1) | carry) & 0xFFFFu);
+            carry = wm >> 15;
+        }
+        prev_space = carry != 0;
+    }
+#endif
+    for (; i < n; ++i) {
+        unsigned char ch = static_cast<unsigned char>(p[i]);
+        bool sp = ch == ' ' || (ch >= 9 && ch <= 13);
+        c.lines += ch == '\n';
+        c.words += !sp && prev_space;
+        prev_space = sp;
+    }
 }
 
-static void cmd_find(const vector<string>& a) {
-    string p = "."; if (a.size() > 1) p = a[1];
-    try { for (auto &e : fs::recursive_directory_iterator(p)) cout << e.path().string() << '\n'; }
-    catch (const exception &ex) { eprint_colored(MTColor::RED, string("find: ") + ex.what() + '\n'); }
-}
+// -- substring search ------------------------------------------------------
+// Fixed-string search over whole buffers. Short patterns use the SIMD
+// first/last-byte filter (compare the pattern's first and last byte against
+// 16/32 candidate positions at once, memcmp only where both hit); long ones
+// use Boyer-Moore-Horspool, whose skips grow with the pattern.
+class Searcher {
+public:
+    explicit Searcher(string_view pat) : pat_(pat) {
+        const size_t k = pat_.size();
+        if (k >= BMH_MIN) {
+            for (auto &v : skip_) v = k;
+            for (size_t i = 0; i + 1 < k; ++i) skip_[static_cast<unsigned char>(pat_[i])] = k - 1 - i;
+        }
+    }
+    size_t size() const { return pat_.size(); }
+
+    // Offset of the first occurrence in [hay, hay+n), or n if there is none.
+    size_t find(const char *hay, size_t n) const {
+        const size_t k = pat_.size();
+        if (k == 0) return 0;
+        if (k > n) return n;
+        if (k == 1) {
+            const void *p = memchr(hay, pat_[0], n);
+            return p ? static_cast<size_t>(static_cast<const char*>(p) - hay) : n;
+        }
+        if (k >= BMH_MIN) return find_bmh(hay, n);
+#ifdef CT_X86_SIMD
+        if (cpu_has_avx2()) return find_avx2(hay, n);
+        return find_sse2(hay, n);
+#else
+        return find_scalar(hay, n, 0);
+#endif
+    }
+
+private:
+    static constexpr size_t BMH_MIN = 32;
+
+    size_t find_scalar(const char *hay, size_t n, size_t from) const {
+        const size_t k = pat_.size();
+        while (from + k <= n) {
+            const char *p = static_cast<const char*>(memchr(hay + from, pat_[0], n - k + 1 - from));
+            if (!p) return n;
+            if (memcmp(p + 1, pat_.data() + 1, k - 1) == 0) return static_cast<size_t>(p - hay);
+            from = static_cast<size_t>(p - hay) + 1;
+        }
+        return n;
+    }
+
+#ifdef CT_X86_SIMD
+    size_t find_sse2(const char *hay, size_t n) const {
+        const size_t k = pat_.size();
+        const __m128i F = _mm_set1_epi8(pat_[0]), L = _mm_set1_epi8(pat_[k - 1]);
+        size_t i = 0;
+        for (; i + k - 1 + 16 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + k - 1));
+            uint32_t m = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, F), _mm_cmpeq_epi8(b, L))));
+            for (; m; m &= m - 1) {
+                size_t at = i + ctz32(m);
+                if (memcmp(hay + at + 1, pat_.data() + 1, k - 2) == 0) return at;
+            }
+        }
+        return find_scalar(hay, n, i);
+    }
+
+    CT_TARGET_AVX2 size_t find_avx2(const char *hay, size_t n) const {
+        const size_t k = pat_.size();
+        const __m256i F = _mm256_set1_epi8(pat_[0]), L = _mm256_set1_epi8(pat_[k - 1]);
+        size_t i = 0;
+        for (; i + k - 1 + 32 <= n; i += 32) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i + k - 1));
+            uint32_t m = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, F), _mm256_cmpeq_epi8(b, L))));
+            for (; m; m &= m - 1) {
+                size_t at = i + ctz32(m);
+                if (memcmp(hay + at + 1, pat_.data() + 1, k - 2) == 0) return at;
+            }
+        }
+        return find_scalar(hay, n, i);
+    }
+#endif
+
+    size_t find_bmh(const char *hay, size_t n) const {
+        const size_t k = pat_.size();
+        const unsigned char last = static_cast<unsigned char>(pat_[k - 1]);
+        for (size_t i = 0; i + k <= n; ) {
+            unsigned char c = static_cast<unsigned char>(hay[i + k - 1]);
+            if (c == last && memcmp(hay + i, pat_.data(), k - 1) == 0) return i;
+            i += skip_[c];
+        }
+        return n;
+    }
+
+    string pat_;
+    size_t skip_[256];
+};
+
+// -- regex (lazy DFA) ------------------------------------------------------
+// POSIX-ERE-style patterns for grep -E. The pattern is parsed to a small AST,
+// compiled to a Thompson NFA, and executed as a DFA whose states are built on
+// demand and cached, so matching is linear in the input with one table lookup
+// per byte. The longest literal every match must contain is extracted up
+// front so grep can skip lines with a plain substring scan.
+//
+// Supported: literals, . [] [^] [:class:], \d \w \s (and negations), ( ) |,
+// * + ? {m} {m,} {m,n}, ^ and $. Not supported: backreferences, \b.
+class Regex {
+public:
+    explicit Regex(string_view pat) : src_(pat) {
+        Node root = parse_alt();
+        if (pos_ != src_.size()) throw runtime_error("unmatched ')'");
+        literal_ = required(root);
+        Frag f = compile(root);
+        nodes_[f.end].out = add(NState::MATCH);
+        start_ = f.start;
+        src_ = {};   // only needed while parsing
+        reset_cache();
+    }
+
+    // True if some substring of the line [p, p+n) matches.
+    bool match(const char *p, size_t n) {
+        int s = initial_;
+        if (accept_[s]) return true;
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = static_cast<unsigned char>(p[i]);
+            int t = trans_[static_cast<size_t>(s) * 256 + c];
+            if (t < 0) t = build(s, c);
+            s = t;
+            if (accept_[s]) return true;
+            if (dead_[s]) return false;
+        }
+        return accept_eol_[s] != 0;
+    }
+
+    const string &required_literal() const { return literal_; }
+
+private:
+    // -- parser ----------------------------------------------------------
+    struct Node {
+        enum Kind { SET, CAT, ALT, REPEAT, BOL, EOL, EMPTY } kind = EMPTY;
+        int set = -1;
+        int min = 0, max = 0;   // REPEAT; max < 0 is unbounded
+        vector<Node> kids;
+    };
+    using ByteSet = bitset<256>;
+
+    bool more() const { return pos_ < src_.size(); }
+    char peek() const { return src_[pos_]; }
+
+    int add_set(const ByteSet &b) { sets_.push_back(b); return static_cast<int>(sets_.size()) - 1; }
+    static Node set_node(int idx) { Node n; n.kind = Node::SET; n.set = idx; return n; }
+
+    Node parse_alt() {
+        Node first = parse_cat();
+        if (!more() || peek() != '|') return first;
+        Node alt; alt.kind = Node::ALT; alt.kids.push_back(move(first));
+        while (more() && peek() == '|') { ++pos_; alt.kids.push_back(parse_cat()); }
+        return alt;
+    }
+
+    Node parse_cat() {
+        Node cat; cat.kind = Node::CAT;
+        while (more() && peek() != '|' && peek() != ')') cat.kids.push_back(parse_repeat());
+        if (cat.kids.empty()) return Node{};
+        if (cat.kids.size() == 1) return move(cat.kids[0]);
+        return cat;
+    }
+
+    bool parse_int(int &v) {
+        size_t start = pos_; v = 0;
+        while (more() && isdigit(static_cast<unsigned char>(peek()))) {
+            v = v * 10 + (peek() - '0'); ++pos_;
+            if (v > 1000) throw runtime_error("repeat count too large");
+        }
+        return pos_ > start;
+    }
+
+    Node parse_repeat() {
+        Node atom = parse_atom();
+        while (more()) {
+            int lo, hi;
+            char c = peek();
+            if (c == '*') { lo = 0; hi = -1; ++pos_; }
+            else if (c == '+') { lo = 1; hi = -1; ++pos_; }
+            else if (c == '?') { lo = 0; hi = 1; ++pos_; }
+            else if (c == '{' && pos_ + 1 < src_.size() && isdigit(static_cast<unsigned char>(src_[pos_ + 1]))) {
+                ++pos_; parse_int(lo); hi = lo;
+                if (more() && peek() == ',') { ++pos_; if (!parse_int(hi)) hi = -1; }
+                if (!more() || peek() != '}') throw runtime_error("bad {m,n} repeat");
+                ++pos_;
+                if (hi >= 0 && hi < lo) throw runtime_error("bad {m,n} repeat");
+            } else break;
+            Node r; r.kind = Node::REPEAT; r.min = lo; r.max = hi; r.kids.push_back(move(atom));
+            atom = move(r);
+        }
+        return atom;
+    }
+
+    static ByteSet class_set(char c) {
+        ByteSet b;
+        for (int i = 0; i < 256; ++i) {
+            bool in = false;
+            switch (c) {
+                case 'd': case 'D': in = isdigit(i) != 0; break;
+                case 'w': case 'W': in = isalnum(i) || i == '_'; break;
+                case 's': case 'S': in = isspace(i) != 0; break;
+            }
+            b[i] = in;
+        }
+        if (isupper(static_cast<unsigned char>(c))) { b.flip(); b['\n'] = false; }
+        return b;
+    }
+
+    char parse_escape_char(char c) {
+        switch (c) {
+            case 't': return '\t';
+            case 'n': return '\n';
+            case 'r': return '\r';
+            case 'f': return '\f';
+            case 'v': return '\v';
+            default:
+                if (isalnum(static_cast<unsigned char>(c))) throw runtime_error(string("unsupported escape \\") + c);
+                return c;
+        }
+    }
+
+    Node parse_atom() {
+        char c = peek(); ++pos_;
+        switch (c) {
+            case '(': {
+                Node inner = parse_alt();
+                if (!more() || peek() != ')') throw runtime_error("unmatched '('");
+                ++pos_;
+                return inner;
+            }
+            case '*': case '+': case '?': throw runtime_error("nothing to repeat");
+            case '^': { Node n; n.kind = Node::BOL; return n; }
+            case '$': { Node n; n.kind = Node::EOL; return n; }
+            case '.': { ByteSet b; b.set(); b['\n'] = false; return set_node(add_set(b)); }
+            case '[': return set_node(add_set(parse_bracket()));
+            case '\\': {
+                if (!more()) throw runtime_error("trailing backslash");
+                char e = peek(); ++pos_;
+                if (strchr("dDwWsS", e)) return set_node(add_set(class_set(e)));
+                ByteSet b; b[static_cast<unsigned char>(parse_escape_char(e))] = true;
+                return set_node(add_set(b));
+            }
+            default: { ByteSet b; b[static_cast<unsigned char>(c)] = true; return set_node(add_set(b)); }
+        }
+    }
+
+    ByteSet parse_bracket() {
+        ByteSet b;
+        bool neg = more() && peek() == '^';
+        if (neg) ++pos_;
+        bool first = true;
+        while (true) {
+            if (!more()) throw runtime_error("unmatched '['");
+            char c = peek();
+            if (c == ']' && !first) { ++pos_; break; }
+            first = false;
+            if (c == '[' && pos_ + 1 < src_.size() && src_[pos_ + 1] == ':') {
+                size_t close = src_.find(":]", pos_ + 2);
+                if (close == string_view::npos) throw runtime_error("bad character class");
+                string_view name = src_.substr(pos_ + 2, close - pos_ - 2);
+                pos_ = close + 2;
+                for (int i = 0; i < 256; ++i) {
+                    bool in = name == "alpha" ? isalpha(i) : name == "digit" ? isdigit(i) : name == "alnum" ? isalnum(i)
+                            : name == "space" ? isspace(i) : name == "upper" ? isupper(i) : name == "lower" ? islower(i)
+                            : name == "punct" ? ispunct(i) : name == "xdigit" ? isxdigit(i) : name == "blank" ? (i == ' ' || i == '\t')
+                            : throw runtime_error("unknown class [:" + string(name) + ":]");
+                    if (in) b[i] = true;
+                }
+                continue;
+            }
+            ++pos_;
+            unsigned char lo = static_cast<unsigned char>(c);
+            if (c == '\\' && more()) {
+                char e = peek(); ++pos_;
+                if (strchr("dDwWsS", e)) { b |= class_set(e); continue; }
+                lo = static_cast<unsigned char>(parse_escape_char(e));
+            }
+            unsigned char hi = lo;
+            if (pos_ + 1 < src_.size() && peek() == '-' && src_[pos_ + 1] != ']') {
+                hi = static_cast<unsigned char>(src_[pos_ + 1]);
+                pos_ += 2;
+                if (hi < lo) throw runtime_error("bad range in []");
+            }
+            for (int i = lo; i <= hi; ++i) b[i] = true;
+        }
+        if (neg) { b.flip(); b['\n'] = false; }
+        return b;
+    }
+
+    // Longest string every match must contain ("" if none is known).
+    string required(const Node &n) const {
+        switch (n.kind) {
+            case Node::SET:
+                if (sets_[n.set].count() == 1)
+                    for (int i = 0; i < 256; ++i) if (sets_[n.set][i]) return string(1, static_cast<char>(i));
+                return "";
+            case Node::REPEAT: return n.min > 0 ? required(n.kids[0]) : "";
+            case Node::CAT: {
+                string best, run;
+                for (auto &k : n.kids) {
+                    if (k.kind == Node::BOL || k.kind == Node::EOL || k.kind == Node::EMPTY) continue;
+                    if (k.kind == Node::SET && sets_[k.set].count() == 1) { run += required(k); continue; }
+                    if (run.size() > best.size()) best = run;
+                    run.clear();
+                    string sub = required(k);
+                    if (sub.size() > best.size()) best = move(sub);
+                }
+                return run.size() > best.size() ? run : best;
+            }
+            default: return "";
+        }
+    }
+
+    // -- NFA -------------------------------------------------------------
+    struct NState {
+        enum Kind : uint8_t { SET, EPS, SPLIT, BOL, EOL, MATCH } kind;
+        int out = -1, out1 = -1, set = -1;
+    };
+    struct Frag { int start, end; };   // `end` is an EPS whose out is patched later
+
+    int add(NState::Kind k, int set = -1) { nodes_.push_back({k, -1, -1, set}); return static_cast<int>(nodes_.size()) - 1; }
+
+    Frag compile(const Node &n) {
+        switch (n.kind) {
+            case Node::SET: { int s = add(NState::SET, n.set), e = add(NState::EPS); nodes_[s].out = e; return {s, e}; }
+            case Node::BOL: case Node::EOL: {
+                int s = add(n.kind == Node::BOL ? NState::BOL : NState::EOL), e = add(NState::EPS);
+                nodes_[s].out = e; return {s, e};
+            }
+            case Node::EMPTY: { int e = add(NState::EPS); return {e, e}; }
+            case Node::CAT: {
+                Frag f = compile(n.kids[0]);
+                for (size_t i = 1; i < n.kids.size(); ++i) { Frag g = compile(n.kids[i]); nodes_[f.end].out = g.start; f.end = g.end; }
+                return f;
+            }
+            case Node::ALT: {
+                int e = add(NState::EPS), s = -1;
+                for (size_t i = n.kids.size(); i-- > 0; ) {
+                    Frag g = compile(n.kids[i]);
+                    nodes_[g.end].out = e;
+                    if (s < 0) s = g.start;
+                    else { int sp = add(NState::SPLIT); nodes_[sp].out = g.start; nodes_[sp].out1 = s; s = sp; }
+                }
+                return {s, e};
+            }
+            case Node::REPEAT: {
+                int s = add(NState::EPS), cur = s;
+                for (int i = 0; i < n.min; ++i) { Frag g = compile(n.kids[0]); nodes_[cur].out = g.start; cur = g.end; }
+                int e = add(NState::EPS);
+                if (n.max < 0) {
+                    Frag g = compile(n.kids[0]);
+                    int loop = add(NState::SPLIT);
+                    nodes_[cur].out = loop; nodes_[loop].out = g.start; nodes_[loop].out1 = e; nodes_[g.end].out = loop;
+                } else {
+                    for (int i = n.min; i < n.max; ++i) {
+                        Frag g = compile(n.kids[0]);
+                        int sp = add(NState::SPLIT);
+                        nodes_[cur].out = sp; nodes_[sp].out = g.start; nodes_[sp].out1 = e; cur = g.end;
+                    }
+                    nodes_[cur].out = e;
+                }
+                return {s, e};
+            }
+        }
+        throw runtime_error("regex: bad node");
+    }
+
+    // Epsilon closure of `seeds` into sorted consuming/EOL/MATCH states.
+    // `^` only passes at the start of the line.
+    vector<int> closure(vector<int> &seeds, bool bol) {
+        vector<int> outv;
+        ++gen_;
+        while (!seeds.empty()) {
+            int i = seeds.back(); seeds.pop_back();
+            if (i < 0 || mark_[i] == gen_) continue;
+            mark_[i] = gen_;
+            const NState &s = nodes_[i];
+            switch (s.kind) {
+                case NState::SET: case NState::EOL: case NState::MATCH: outv.push_back(i); break;
+                case NState::EPS: seeds.push_back(s.out); break;
+                case NState::SPLIT: seeds.push_back(s.out1); seeds.push_back(s.out); break;
+                case NState::BOL: if (bol) seeds.push_back(s.out); break;
+            }
+        }
+        sort(outv.begin(), outv.end());
+        return outv;
+    }
+
+    // Whether the line may end in this state: MATCH reachable through `$`s.
+    bool accepts_at_eol(const vector<int> &set, bool bol) {
+        vector<int> seeds;
+        for (int i : set) if (i >= 0 && nodes_[i].kind == NState::EOL) seeds.push_back(nodes_[i].out);
+        ++gen_;
+        while (!seeds.empty()) {
+            int i = seeds.back(); seeds.pop_back();
+            if (i < 0 || mark_[i] == gen_) continue;
+            mark_[i] = gen_;
+            const NState &s = nodes_[i];
+            switch (s.kind) {
+                case NState::MATCH: return true;
+                case NState::EPS: case NState::EOL: seeds.push_back(s.out); break;
+                case NState::SPLIT: seeds.push_back(s.out); seeds.push_back(s.out1); break;
+                case NState::BOL: if (bol) seeds.push_back(s.out); break;
+                case NState::SET: break;
+            }
+        }
+        return false;
+    }
+
+    // -- lazy DFA ----------------------------------------------------------
+    // A DFA state is a sorted NFA state set; the initial state carries a -1
+    // marker so it never aliases a later state with the same set (it alone
+    // may still pass `^`).
+    static constexpr size_t MAX_STATES = 4096;
+
+    int intern(vector<int> set) {
+        auto it = ids_.find(set);
+        if (it != ids_.end()) return it->second;
+        bool bol = !set.empty() && set[0] == -1;
+        bool acc = false;
+        for (int i : set) if (i >= 0 && nodes_[i].kind == NState::MATCH) acc = true;
+        int id = static_cast<int>(state_sets_.size());
+        accept_.push_back(acc);
+        accept_eol_.push_back(acc || accepts_at_eol(set, bol));
+        dead_.push_back(!acc && set.size() == (bol ? 1u : 0u));
+        trans_.resize(trans_.size() + 256, -1);
+        state_sets_.push_back(set);
+        ids_.emplace(move(set), id);
+        return id;
+    }
+
+    void reset_cache() {
+        ids_.clear(); state_sets_.clear(); trans_.clear();
+        accept_.clear(); accept_eol_.clear(); dead_.clear();
+        mark_.assign(nodes_.size(), 0);
+        vector<int> seeds{start_};
+        vector<int> init = closure(seeds, true);
+        init.insert(init.begin(), -1);
+        initial_ = intern(move(init));
+    }
+
+    int build(int s, unsigned char c) {
+        if (state_sets_.size() >= MAX_STATES) {
+            // Cache full: start over, keeping only the state we are in.
+            vector<int> keep = state_sets_[s];
+            reset_cache();
+            s = intern(move(keep));
+        }
+        vector<int> seeds;
+        for (int i : state_sets_[s])
+            if (i >= 0 && nodes_[i].kind == NState::SET && sets_[nodes_[i].set][c]) seeds.push_back(nodes_[i].out);
+        seeds.push_back(start_);   // unanchored: a match may start at any byte
+        int t = intern(closure(seeds, false));
+        trans_[static_cast<size_t>(s) * 256 + c] = t;
+        return t;
+    }
+
+    string_view src_;
+    size_t pos_ = 0;
+    vector<ByteSet> sets_;
+    vector<NState> nodes_;
+    int start_ = -1;
+    string literal_;
+
+    map<vector<int>, int> ids_;
+    vector<vector<int>> state_sets_;
+    vector<int> trans_;
+    vector<uint8_t> accept_, accept_eol_, dead_;
+    vector<uint32_t> mark_;
+    uint32_t gen_ = 0;
+    int initial_ = -1;
+};
+
+// -- work-stealing pool ----------------------------------------------------
+// Each worker owns a deque: it pushes and pops its own tasks at the back and,
+// when that runs dry, steals from the front of the others, so a task that fans
+// out (a directory spawning its subdirectories) keeps its work local while
+// idle workers take the oldest, usually largest, pieces. Tasks may submit
+// more tasks; wait() returns once everything submitted has run.
+class WorkPool {
+public:
+    explicit WorkPool(unsigned threads = thread::hardware_concurrency())
+        : nq_(max(1u, threads)), queues_(new Queue[nq_]) {
+        for (unsigned i = 0; i < nq_; ++i) threads_.emplace_back([this, i] { work(i); });
+    }
+    ~WorkPool() {
+        { lock_guard<mutex> lk(m_); stop_ = true; }
+        cv_.notify_all();
+        for (auto &t : threads_) t.join();
+    }
+    WorkPool(const WorkPool&) = delete;
+    WorkPool &operator=(const WorkPool&) = delete;
+
+    unsigned size() const { return nq_; }
+    // Index of the calling worker in its pool, or -1 outside any pool.
+    static int worker_index() { return tl_index; }
+
+    void submit(function<void()> task) {
+        pending_.fetch_add(1);
+        unsigned q = (tl_pool == this) ? static_cast<unsigned>(tl_index) : next_.fetch_add(1) % nq_;
+        { lock_guard<mutex> lk(queues_[q].m); queues_[q].d.push_back(move(task)); }
+        { lock_guard<mutex> lk(m_); ++queued_; }
+        cv_.notify_one();
+    }
+
+    void wait() {
+        unique_lock<mutex> lk(m_);
+        done_cv_.wait(lk, [this] { return pending_.load() == 0; });
+    }
+
+private:
+    struct Queue { mutex m; deque<function<void()>> d; };
+
+    bool take(unsigned self, function<void()> &task) {
+        {
+            lock_guard<mutex> lk(queues_[self].m);
+            if (!queues_[self].d.empty()) { task = move(queues_[self].d.back()); queues_[self].d.pop_back(); return true; }
+        }
+        for (unsigned k = 1; k < nq_; ++k) {
+            Queue &v = queues_[(self + k) % nq_];
+            lock_guard<mutex> lk(v.m);
+            if (!v.d.empty()) { task = move(v.d.front()); v.d.pop_front(); return true; }
+        }
+        return false;
+    }
+
+    void work(unsigned self) {
+        tl_pool = this; tl_index = static_cast<int>(self);
+        function<void()> task;
+        for (;;) {
+            if (take(self, task)) {
+                { lock_guard<mutex> lk(m_); --queued_; }
+                try { task(); } catch (...) {}
+                task = nullptr;
+                if (pending_.fetch_sub(1) == 1) { lock_guard<mutex> lk(m_); done_cv_.notify_all(); }
+                continue;
+            }
+            unique_lock<mutex> lk(m_);
+            cv_.wait(lk, [this] { return stop_ || queued_ > 0; });
+            if (stop_ && queued_ == 0) return;
+        }
+    }
+
+    unsigned nq_;
+    unique_ptr<Queue[]> queues_;
+    vector<thread> threads_;
+    mutex m_;
+    condition_variable cv_, done_cv_;
+    size_t queued_ = 0;            // tasks sitting in deques (guarded by m_)
+    atomic<size_t> pending_{0};    // submitted but not yet finished
+    atomic<unsigned> next_{0};
+    bool stop_ = false;
+    static inline thread_local WorkPool *tl_pool = nullptr;
+    static inline thread_local int tl_index = -1;
+};
+
+// Serializes writes to `out` from pool workers.
+static mutex out_mutex;
+
+// -- glob matching ---------------------------------------------------------
+// Shell-style globs compiled once into tokens: * (not across '/'), ** (across
+// '/'), ?, [set] / [!set] and literals. With `icase`, literals are stored
+// lower-cased and sets hold both cases, so matching only folds the subject.
+class Glob {
+public:
+    explicit Glob(string_view pat, bool icase = false) : icase_(icase) {
+        for (size_t i = 0; i < pat.size(); ) {
+            char c = pat[i];
+            if (c == '*') {
+                bool dbl = i + 1 < pat.size() && pat[i + 1] == '*';
+                toks_.push_back({dbl ? Tok::DSTAR : Tok::STAR, {}, {}});
+                deep_ |= dbl;
+                i += dbl ? 2 : 1;
+            } else if (c == '?') {
+                toks_.push_back({Tok::ONE, {}, {}}); ++i;
+            } else if (c != '[' || !set_at(pat, i)) {
+                if (c == '\\' && i + 1 < pat.size()) c = pat[++i];
+                if (toks_.empty() || toks_.back().kind != Tok::LIT) toks_.push_back({Tok::LIT, {}, {}});
+                toks_.back().lit += icase ? static_cast<char>(tolower(static_cast<unsigned char>(c))) : c; ++i;
+            }
+        }
+    }
+
+    bool match(string_view s) const {
+        if (deep_) return match_deep(0, s);
+        // Classic two-pointer match with backtracking to the last '*'.
+        size_t ti = 0, si = 0, star_t = string::npos, star_s = 0;
+        while (si < s.size() || ti < toks_.size()) {
+            if (ti < toks_.size()) {
+                const Tok &t = toks_[ti];
+                if (t.kind == Tok::STAR) { star_t = ti++; star_s = si; continue; }
+                size_t n = step(t, s, si);
+                if (n != string::npos) { si += n; ++ti; continue; }
+            }
+            if (star_t == string::npos || star_s >= s.size() || s[star_s] == '/') return false;
+            ti = star_t + 1; si = ++star_s;
+        }
+        return true;
+    }
+
+private:
+    struct Tok {
+        enum Kind { LIT, ONE, SET, STAR, DSTAR } kind;
+        string lit;
+        bitset<256> set;
+    };
+
+    // Parses the bracket set opening at pat[i] and advances i past it. An
+    // unterminated '[' (as in "[abc" or "[!]") is left for the caller to
+    // take literally, as fnmatch does.
+    bool set_at(string_view pat, size_t &i) {
+        Tok t{Tok::SET, {}, {}};
+        size_t j = i + 1;
+        bool neg = j < pat.size() && (pat[j] == '!' || pat[j] == '^');
+        if (neg) ++j;
+        for (bool first = true; j < pat.size() && (first || pat[j] != ']'); first = false, ++j) {
+            unsigned char lo = static_cast<unsigned char>(pat[j]), hi = lo;
+            if (j + 2 < pat.size() && pat[j + 1] == '-' && pat[j + 2] != ']') { hi = static_cast<unsigned char>(pat[j + 2]); j += 2; }
+            for (int k = lo; k <= hi; ++k) t.set[k] = true;
+        }
+        if (j >= pat.size()) return false;
+        if (icase_)
+            for (int k = 'a'; k <= 'z'; ++k) if (t.set[k] || t.set[k - 'a' + 'A']) t.set[k] = t.set[k - 'a' + 'A'] = true;
+        if (neg) t.set.flip();
+        t.set['/'] = false;
+        toks_.push_back(move(t));
+        i = j + 1;
+        return true;
+    }
+
+    // Bytes consumed if token `t` matches at s[si], else npos.
+    size_t step(const Tok &t, string_view s, size_t si) const {
+        switch (t.kind) {
+            case Tok::LIT:
+                if (!icase_) return s.compare(si, t.lit.size(), t.lit) == 0 ? t.lit.size() : string::npos;
+                if (si + t.lit.size() > s.size()) return string::npos;
+                for (size_t k = 0; k < t.lit.size(); ++k)
+                    if (tolower(static_cast<unsigned char>(s[si + k])) != static_cast<unsigned char>(t.lit[k])) return string::npos;
+                return t.lit.size();
+            case Tok::ONE: return si < s.size() && s[si] != '/' ? 1 : string::npos;
+            case Tok::SET: return si < s.size() && t.set[static_cast<unsigned char>(s[si])] ? 1 : string::npos;
+            default: return string::npos;
+        }
+    }
+
+    // Recursive matcher for patterns containing '**'.
+    bool match_deep(size_t ti, string_view s) const {
+        if (ti == toks_.size()) return s.empty();
+        const Tok &t = toks_[ti];
+        if (t.kind == Tok::STAR || t.kind == Tok::DSTAR) {
+            for (size_t k = 0; ; ++k) {
+                if (match_deep(ti + 1, s.substr(k))) return true;
+                if (k == s.size() || (t.kind == Tok::STAR && s[k] == '/')) return false;
+            }
+        }
+        size_t n = step(t, s, 0);
+        return n != string::npos && match_deep(ti + 1, s.substr(n));
+    }
+
+    vector<Tok> toks_;
+    bool deep_ = false;
+    bool icase_ = false;
+};
+
+// -- .gitignore rules ------------------------------------------------------
+// One node per directory that has a .gitignore, chained to its parent's.
+// Later rules win within a file and deeper files win over shallower ones.
+struct IgnoreRules {
+    struct Rule { Glob glob; bool negate, dir_only, anchored; };
+    string base;    // directory holding the file, with trailing separator
+    vector<Rule> rules;
+    shared_ptr<const IgnoreRules> parent;
+
+    // Rules for `dir`: its own .gitignore chained to `parent`, or `parent` itself.
+    static shared_ptr<const IgnoreRules> load(const string &dir, shared_ptr<const IgnoreRules> parent) {
+        string base = dir;
+        if (base.empty() || base.back() != '/') base += '/';
+        LineReader r(base + ".gitignore", 1 << 14);
+        if (!r.ok()) return parent;
+        auto rs = make_shared<IgnoreRules>();
+        rs->base = base; rs->parent = move(parent);
+        string_view line;
+        while (r.next(line)) {
+            while (!line.empty() && (line.back() == ' ' || line.back() == '\r')) line.remove_suffix(1);
+            if (line.empty() || line[0] == '#') continue;
+            bool neg = line[0] == '!';
+            if (neg) line.remove_prefix(1);
+            bool dir_only = !line.empty() && line.back() == '/';
+            if (dir_only) line.remove_suffix(1);
+            bool anchored = line.find('/') != string_view::npos;
+            if (!line.empty() && line[0] == '/') line.remove_prefix(1);
+            if (line.empty()) continue;
+            rs->rules.push_back({Glob(line), neg, dir_only, anchored});
+        }
+        return rs;
+    }
+
+    static bool ignored(const IgnoreRules *rs, const string &path, string_view name, bool is_dir) {
+        for (; rs; rs = rs->parent.get()) {
+            if (path.compare(0, rs->base.size(), rs->base) != 0) continue;
+            string_view rel = string_view(path).substr(rs->base.size());
+            for (auto it = rs->rules.rbegin(); it != rs->rules.rend(); ++it) {
+                if (it->dir_only && !is_dir) continue;
+                if (it->glob.match(it->anchored ? rel : name)) return !it->negate;
+            }
+        }
+        return false;
+    }
+};
+
+// -- parallel tree walk ----------------------------------------------------
+// One engine behind find, du, count and tree. Every directory is one pool
+// task: it is opened once, read in large getdents64 batches and handed to the
+// visitor with the d_type of each entry, so most commands need no stat at all.
+// Entries whose type the filesystem does not report are resolved with one
+// fstatat relative to the open directory. Errors (permissions, vanished
+// directories) are reported and the walk carries on.
+enum class FileType : uint8_t { Unknown, Regular, Dir, Symlink, Other };
+
+struct DirEntry {
+    string name;
+    FileType type = FileType::Unknown;   // with follow_links: the target's type
+    bool link = false;                   // reached through a symlink
+    bool descend = false;                // set for subdirectories; the visitor may clear it
+    void *ctx = nullptr;                 // handed to that subdirectory's WalkDir
+};
+
+struct WalkDir {
+    string path;
+    int fd = -1;                         // open during the visit (POSIX), -1 elsewhere
+    int depth = 0;                       // the root is 0, its entries are depth 1
+    void *ctx = nullptr;
+    bool partial = false;                // reading failed part way; entries are incomplete
+    vector<DirEntry> entries;
+    string child(const DirEntry &e) const {
+        return (path.empty() || path.back() == '/') ? path + e.name : path + '/' + e.name;
+    }
+};
+
+// What the walkers need from stat(2). Times are nanoseconds since the epoch
+// (on Windows, of the filesystem clock; compare with file_now()).
+struct FileMeta {
+    FileType type = FileType::Unknown;
+    uintmax_t size = 0, blocks = 0;      // blocks: bytes actually allocated
+    uint64_t dev = 0, ino = 0, nlink = 1;
+    int64_t mtime = 0, ctime = 0;
+    uint32_t mode = 0;
+};
+
+static int64_t file_now() {
+#ifndef _WIN32
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(fs::file_time_type::clock::now().time_since_epoch()).count();
+#endif
+}
+
+#ifndef _WIN32
+// st_atim/st_mtim/st_ctim are the Linux names; macOS calls them st_*timespec.
+enum class StatTime { Access, Modify, Change };
+static struct timespec stat_time(const struct stat &st, StatTime which) {
+#ifdef __APPLE__
+    return which == StatTime::Access ? st.st_atimespec : which == StatTime::Modify ? st.st_mtimespec : st.st_ctimespec;
+#else
+    return which == StatTime::Access ? st.st_atim : which == StatTime::Modify ? st.st_mtim : st.st_ctim;
+#endif
+}
+static int64_t stat_ns(const struct stat &st, StatTime which) {
+    struct timespec ts = stat_time(st, which);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static FileType type_of_mode(mode_t m) {
+    return S_ISREG(m) ? FileType::Regular : S_ISDIR(m) ? FileType::Dir : S_ISLNK(m) ? FileType::Symlink : FileType::Other;
+}
+
+static void meta_from_stat(const struct stat &st, FileMeta &m) {
+    m.type = type_of_mode(st.st_mode);
+    m.size = static_cast<uintmax_t>(st.st_size);
+    m.blocks = static_cast<uintmax_t>(st.st_blocks) * 512;
+    m.dev = st.st_dev; m.ino = st.st_ino; m.nlink = st.st_nlink;
+    m.mtime = stat_ns(st, StatTime::Modify);
+    m.ctime = stat_ns(st, StatTime::Change);
+    m.mode = st.st_mode;
+}
+#endif
+
+static bool stat_path(const string &path, FileMeta &m, bool follow = true) {
+#ifndef _WIN32
+    struct stat st;
+    if ((follow ? stat(path.c_str(), &st) : lstat(path.c_str(), &st)) != 0) return false;
+    meta_from_stat(st, m);
+    return true;
+#else
+    error_code ec;
+    auto s = follow ? fs::status(path, ec) : fs::symlink_status(path, ec);
+    if (ec) return false;
+    m.type = fs::is_regular_file(s) ? FileType::Regular : fs::is_directory(s) ? FileType::Dir
+           : fs::is_symlink(s) ? FileType::Symlink : FileType::Other;
+    m.size = m.blocks = m.type == FileType::Regular ? fs::file_size(path, ec) : 0;
+    m.mtime = m.ctime = chrono::duration_cast<chrono::nanoseconds>(fs::last_write_time(path, ec).time_since_epoch()).count();
+    m.mode = static_cast<uint32_t>(s.permissions());
+    return true;
+#endif
+}
+
+// stat of one entry, relative to the directory being visited.
+static bool stat_entry(const WalkDir &d, const DirEntry &e, FileMeta &m, bool follow = false) {
+#ifndef _WIN32
+    struct stat st;
+    if (fstatat(d.fd, e.name.c_str(), &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) return false;
+    meta_from_stat(st, m);
+    return true;
+#else
+    return stat_path(d.child(e), m, follow);
+#endif
+}
+
+// stat of the directory being visited itself.
+static bool stat_dir(const WalkDir &d, FileMeta &m) {
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(d.fd, &st) != 0) return false;
+    meta_from_stat(st, m);
+    return true;
+#else
+    return stat_path(d.path, m);
+#endif
+}
+
+// Calls emit(DirEntry&&) for each entry of an open directory except . and ..,
+// batch by batch as the kernel returns them.
+template <typename Emit>
+static bool scan_dir(const WalkDir &d, Emit &&emit, error_code &ec) {
+#if defined(__linux__)
+    static thread_local unique_ptr<char[]> buf(new char[1 << 18]);
+    for (;;) {
+        long n = syscall(SYS_getdents64, d.fd, buf.get(), 1 << 18);
+        if (n < 0) { ec.assign(errno, generic_category()); return false; }
+        if (n == 0) return true;
+        for (long off = 0; off < n;) {
+            // struct linux_dirent64: ino, off, reclen, type, name
+            const char *rec = buf.get() + off;
+            unsigned short reclen; memcpy(&reclen, rec + 16, sizeof reclen);
+            unsigned char type = static_cast<unsigned char>(rec[18]);
+            const char *name = rec + 19;
+            off += reclen;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+            DirEntry e; e.name = name;
+            e.type = type == DT_REG ? FileType::Regular : type == DT_DIR ? FileType::Dir : type == DT_LNK ? FileType::Symlink
+                   : type == DT_UNKNOWN ? FileType::Unknown : FileType::Other;
+            emit(move(e));
+        }
+    }
+#elif !defined(_WIN32)
+    int fd = dup(d.fd);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : nullptr;
+    if (!dir) { ec.assign(errno, generic_category()); if (fd >= 0) close(fd); return false; }
+    while (struct dirent *de = readdir(dir)) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) continue;
+        DirEntry e; e.name = name;
+#ifdef DT_UNKNOWN
+        e.type = de->d_type == DT_REG ? FileType::Regular : de->d_type == DT_DIR ? FileType::Dir
+               : de->d_type == DT_LNK ? FileType::Symlink : de->d_type == DT_UNKNOWN ? FileType::Unknown : FileType::Other;
+#endif
+        emit(move(e));
+    }
+    closedir(dir);
+    return true;
+#else
+    fs::directory_iterator it(d.path, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        DirEntry e; e.name = it->path().filename().string();
+        error_code tec;
+        auto s = it->symlink_status(tec);
+        e.type = fs::is_symlink(s) ? FileType::Symlink : fs::is_directory(s) ? FileType::Dir
+               : fs::is_regular_file(s) ? FileType::Regular : FileType::Other;
+        emit(move(e));
+    }
+    return !ec;
+#endif
+}
+
+static bool read_dir(WalkDir &d, error_code &ec) {
+    return scan_dir(d, [&d](DirEntry &&e) { d.entries.push_back(move(e)); }, ec);
+}
+
+struct WalkOptions {
+    const char *who = "walk";            // prefix for error messages
+    bool follow_links = false;           // descend through symlinked directories (loops are detected)
+    function<void(const string &path, const string &msg)> on_error;   // default: print to stderr
+};
+
+// walk_tree(root, opt, visit): visit(WalkDir&) runs on pool workers, once per
+// directory, concurrently with other directories; it must synchronize any
+// shared state itself. Subdirectories are queued after it returns, so a
+// directory is always visited before its children. The optional prefill hook
+// runs first, with the directory open: it may supply d.entries itself (from a
+// cache, say) and return true, and then the directory is neither read nor
+// visited; its entries marked `descend` are walked as usual. The optional
+// leave hook gets the directory's ctx when its task ends, whether or not it
+// could be opened, after its subdirectories have been queued.
+class TreeWalker {
+public:
+    TreeWalker(const WalkOptions &opt, function<void(WalkDir&)> visit,
+               function<bool(WalkDir&)> prefill = nullptr, function<void(void*)> leave = nullptr)
+        : opt_(opt), visit_(move(visit)), prefill_(move(prefill)), leave_(move(leave)) {}
+
+    // start() returns at once so the caller can consume results as they come.
+    void start(const string &root, void *ctx) { pool_.submit([this, root, ctx] { dir(root, 0, ctx, nullptr); }); }
+    void wait() { pool_.wait(); }
+    void run(const string &root, void *ctx) { start(root, ctx); wait(); }
+
+private:
+    // Ancestor chain by identity, only kept when following links.
+    struct Node { uint64_t dev, ino; shared_ptr<const Node> parent; };
+
+    void error(const string &path, const string &msg) {
+        if (opt_.on_error) { opt_.on_error(path, msg); return; }
+        lock_guard<mutex> lk(out_mutex);
+        out.flush();
+        eprint_colored(MTColor::RED, string(opt_.who) + ": " + path + ": " + msg + "\n");
+    }
+
+    void dir(const string &path, int depth, void *ctx, shared_ptr<const Node> up) {
+        walk(path, depth, ctx, move(up));
+        if (leave_) leave_(ctx);
+    }
+
+    void walk(const string &path, int depth, void *ctx, shared_ptr<const Node> up) {
+        WalkDir d; d.path = path; d.depth = depth; d.ctx = ctx;
+#ifndef _WIN32
+        d.fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | ((opt_.follow_links || depth == 0) ? 0 : O_NOFOLLOW));
+        if (d.fd < 0) { error(path, strerror(errno)); return; }
+        if (opt_.follow_links) {
+            struct stat st;
+            if (fstat(d.fd, &st) == 0) {
+                for (const Node *n = up.get(); n; n = n->parent.get())
+                    if (n->dev == st.st_dev && n->ino == st.st_ino) { error(path, "filesystem loop detected"); close(d.fd); return; }
+                up = make_shared<const Node>(Node{ st.st_dev, st.st_ino, move(up) });
+            }
+        }
+#endif
+        if (!prefill_ || !prefill_(d)) read(d);
+#ifndef _WIN32
+        close(d.fd);
+#endif
+        for (auto &e : d.entries) {
+            if (!e.descend) continue;
+            pool_.submit([this, p = d.child(e), depth, c = e.ctx, up] { dir(p, depth + 1, c, up); });
+        }
+    }
+
+    void read(WalkDir &d) {
+        error_code ec;
+        d.partial = !read_dir(d, ec);
+        if (d.partial) error(d.path, ec.message());
+        for (auto &e : d.entries) {
+            if (e.type == FileType::Unknown || (opt_.follow_links && e.type == FileType::Symlink)) {
+                FileMeta m;
+                bool follow = opt_.follow_links;
+                if (stat_entry(d, e, m, follow) || (follow && stat_entry(d, e, m, false))) {
+                    e.link = e.type == FileType::Symlink && m.type != FileType::Symlink;
+                    e.type = m.type;
+                }
+            }
+            e.descend = e.type == FileType::Dir;
+        }
+        if (!d.partial || !d.entries.empty()) visit_(d);
+    }
+
+    WalkOptions opt_;
+    function<void(WalkDir&)> visit_;
+    function<bool(WalkDir&)> prefill_;
+    function<void(void*)> leave_;
+    WorkPool pool_;
+};
+
+static void walk_tree(const string &root, const WalkOptions &opt, function<void(WalkDir&)> visit, void *ctx = nullptr,
+                      function<bool(WalkDir&)> prefill = nullptr) {
+    TreeWalker(opt, move(visit), move(prefill)).run(root, ctx);
+}
+
+// -- progress line ---------------------------------------------------------
+// A background thread redraws one stderr line twice a second with what is
+// done (bytes, or a plain count), out of the total when one is known, the
+// rate and an ETA. Workers only bump the atomics.
+static string human_bytes(double b) {
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    int u = 0;
+    while (b >= 1024 && u < 4) { b /= 1024; ++u; }
+    char buf[32]; snprintf(buf, sizeof buf, u ? "%.1f %s" : "%.0f %s", b, units[u]);
+    return buf;
+}
+
+class ProgressLine {
+public:
+    atomic<uintmax_t> done{0}, total{0};
+
+    ProgressLine(string what, bool enabled, bool bytes = true) : what_(move(what)), bytes_(bytes) {
+        if (enabled) th_ = thread([this] { loop(); });
+    }
+    ~ProgressLine() { stop(); }
+    ProgressLine(const ProgressLine&) = delete;
+    ProgressLine &operator=(const ProgressLine&) = delete;
+
+    void stop() {
+        if (!th_.joinable()) return;
+        { lock_guard<mutex> lk(m_); stop_ = true; }
+        cv_.notify_all();
+        th_.join();
+        if (!drawn_) return;
+        // a terminal gets the line wiped; a log just gets its last update terminated
+        lock_guard<mutex> lk(out_mutex);
+        cerr << (fd_is_tty(2) ? "\r\033[K" : "\n") << flush;
+    }
+
+private:
+    void loop() {
+        auto t0 = chrono::steady_clock::now();
+        unique_lock<mutex> lk(m_);
+        while (!cv_.wait_for(lk, chrono::milliseconds(500), [this] { return stop_; })) {
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            double d = static_cast<double>(done.load()), t = static_cast<double>(total.load());
+            double rate = secs > 0 ? d / secs : 0;
+            auto fmt = [this](double v) { return bytes_ ? human_bytes(v) : to_string(static_cast<uintmax_t>(v)); };
+            string line = "\r" + what_ + ": " + fmt(d);
+            if (t > 0) line += " / " + fmt(t);
+            line += "  " + fmt(rate) + (bytes_ ? "/s" : " entries/s");
+            if (rate > 0 && t > d) {
+                auto eta = static_cast<long long>((t - d) / rate);
+                char buf[32]; snprintf(buf, sizeof buf, "  ETA %lld:%02lld", eta / 60, eta % 60);
+                line += buf;
+            }
+            lock_guard<mutex> olk(out_mutex);
+            cerr << line << "\033[K" << flush;
+            drawn_ = true;
+        }
+    }
+
+    string what_;
+    bool bytes_;
+    bool drawn_ = false;    // written by the thread, read after join
+    thread th_;
+    mutex m_;
+    condition_variable cv_;
+    bool stop_ = false;
+};
+
+// -- tree copy -------------------------------------------------------------
+#ifndef _WIN32
+// Copies one regular file's data. A reflink (FICLONE) shares extents outright
+// on filesystems that support it (XFS, Btrfs), so a same-volume copy costs
+// no data I/O. Otherwise sparse files are copied extent by extent via
+// SEEK_DATA/SEEK_HOLE so holes stay holes, each extent with copy_file_range
+// when the kernel allows it and a 1 MiB pread/pwrite loop when it doesn't.
+static bool copy_file_data(int in, int out, const struct stat &st, atomic<uintmax_t> *progress) {
+    const off_t size = st.st_size;
+#if defined(__linux__) && defined(FICLONE)
+    if (ioctl(out, FICLONE, in) == 0) { if (progress) *progress += static_cast<uintmax_t>(size); return true; }
+#endif
+    static thread_local unique_ptr<char[]> buf;
+    bool kernel = true;
+    auto copy_range = [&](off_t off, off_t end) {
+#ifdef __linux__
+        while (kernel && off < end) {
+            loff_t io = off, oo = off;
+            ssize_t n = copy_file_range(in, &io, out, &oo, static_cast<size_t>(min<off_t>(end - off, off_t(1) << 26)), 0);
+            if (n > 0) { off += n; if (progress) *progress += static_cast<uintmax_t>(n); continue; }
+            if (n == 0) return true;   // the source shrank under us; the caller's re-fstat catches it
+            if (errno == EINTR) continue;
+            if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) return false;
+            kernel = false;
+        }
+#endif
+        if (!buf) buf.reset(new char[1 << 20]);
+        while (off < end) {
+            ssize_t n = pread(in, buf.get(), static_cast<size_t>(min<off_t>(end - off, 1 << 20)), off);
+            if (n < 0) { if (errno == EINTR) continue; return false; }
+            if (n == 0) return true;
+            for (ssize_t w = 0; w < n;) {
+                ssize_t k = pwrite(out, buf.get() + w, static_cast<size_t>(n - w), off + w);
+                if (k < 0) { if (errno == EINTR) continue; return false; }
+                w += k;
+            }
+            off += n;
+            if (progress) *progress += static_cast<uintmax_t>(n);
+        }
+        return true;
+    };
+#ifdef SEEK_DATA
+    if (static_cast<off_t>(st.st_blocks) * 512 < size) {
+        for (off_t off = 0; off < size;) {
+            off_t data = lseek(in, off, SEEK_DATA);
+            if (data < 0) break;                       // ENXIO: only a hole remains
+            off_t hole = lseek(in, data, SEEK_HOLE);
+            if (hole < 0) hole = size;
+            if (progress) *progress += static_cast<uintmax_t>(data - off);   // holes count as done
+            if (!copy_range(data, hole)) return false;
+            off = hole;
+        }
+        return ftruncate(out, size) == 0;              // also recreates a trailing hole
+    }
+#endif
+    return copy_range(0, size) && ftruncate(out, size) == 0;
+}
+
+// -p: ownership (when permitted), mode and times, on an open fd or a path.
+static void apply_meta(int fd, const string &path, const struct stat &st, bool link) {
+    struct timespec ts[2] = { stat_time(st, StatTime::Access), stat_time(st, StatTime::Modify) };
+    if (link) {
+        if (lchown(path.c_str(), st.st_uid, st.st_gid) != 0) {}
+        utimensat(AT_FDCWD, path.c_str(), ts, AT_SYMLINK_NOFOLLOW);
+        return;
+    }
+    if (fd >= 0) {
+        if (fchown(fd, st.st_uid, st.st_gid) != 0) {}
+        fchmod(fd, st.st_mode & 07777);
+        futimens(fd, ts);
+    } else {
+        if (chown(path.c_str(), st.st_uid, st.st_gid) != 0) {}
+        chmod(path.c_str(), st.st_mode & 07777);
+        utimensat(AT_FDCWD, path.c_str(), ts, 0);
+    }
+}
+#endif
+
+// cp of a file or a whole tree. The source is walked in parallel; each
+// directory is created as soon as its parent is listed and its files are
+// handed to a separate I/O pool. Every copy task holds at most two
+// descriptors, so open files stay bounded by the pool size however wide the
+// tree is. With -p a directory's own times are set only after everything
+// inside it is written, which would otherwise bump its mtime again.
+class TreeCopier {
+public:
+    TreeCopier(bool preserve, ProgressLine *progress, const char *who = "cp")
+        : preserve_(preserve), who_(who), progress_(progress), io_(max(4u, 2 * thread::hardware_concurrency())) {}
+
+    // Copies src (file, link or directory) to dst; directory contents are
+    // merged into an existing dst. Returns false if anything failed.
+    bool copy(const string &src, const string &dst) {
+#ifdef _WIN32
+        error_code ec;
+        fs::copy(src, dst, fs::copy_options::recursive | fs::copy_options::overwrite_existing, ec);
+        if (ec) error(src, ec.message());
+        return !ec;
+#else
+        struct stat st;
+        if (lstat(src.c_str(), &st) != 0) { error(src, strerror(errno)); return false; }
+        if (!S_ISDIR(st.st_mode)) {
+            entry(src, dst, st, nullptr);
+            io_.wait();
+            return errors_ == 0;
+        }
+        error_code ec;
+        fs::path rs = fs::canonical(src, ec), rd = fs::weakly_canonical(fs::absolute(dst), ec);
+        string rss = rs.string() + "/", rds = rd.string() + "/";
+        if (!ec && rds.compare(0, rss.size(), rss) == 0) { error(dst, "cannot copy a directory into itself"); return false; }
+        if (!make_dir(dst, st)) return false;
+        nodes_.emplace_back();
+        Node &root = nodes_.back();
+        root.dst = dst; root.st = st;
+        WalkOptions opt; opt.who = "cp";
+        opt.on_error = [this](const string &path, const string &msg) { error(path, msg); };
+        TreeWalker w(opt, [this](WalkDir &d) { visit(d); }, nullptr, [this](void *ctx) { finish(*static_cast<Node*>(ctx)); });
+        w.run(src, &root);
+        io_.wait();
+        return errors_ == 0;
+#endif
+    }
+
+    size_t files() const { return files_; }
+
+private:
+#ifndef _WIN32
+    // One per directory: how many of its parts are still being copied
+    // (its own listing, each file, each subdirectory).
+    struct Node {
+        string dst;
+        struct stat st;
+        Node *parent = nullptr;
+        atomic<size_t> pending{1};
+    };
+
+    bool make_dir(const string &dst, const struct stat &st) {
+        if (mkdir(dst.c_str(), (st.st_mode & 07777) | S_IRWXU) == 0) return true;
+        struct stat cur;
+        if (errno == EEXIST && stat(dst.c_str(), &cur) == 0 && S_ISDIR(cur.st_mode)) return true;
+        error(dst, strerror(errno));
+        return false;
+    }
+
+    void visit(WalkDir &d) {
+        Node &n = *static_cast<Node*>(d.ctx);
+        for (auto &e : d.entries) {
+            struct stat st;
+            string src = d.child(e), dst = n.dst + '/' + e.name;
+            if (fstatat(d.fd, e.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) { error(src, strerror(errno)); e.descend = false; continue; }
+            if (!S_ISDIR(st.st_mode)) { e.descend = false; entry(src, dst, st, &n); continue; }
+            if (!make_dir(dst, st)) { e.descend = false; continue; }
+            Node *k;
+            {
+                lock_guard<mutex> lk(nodes_m_);
+                nodes_.emplace_back();
+                k = &nodes_.back();
+            }
+            k->dst = move(dst); k->st = st; k->parent = &n;
+            ++n.pending;
+            e.ctx = k;
+        }
+    }
+
+    // A non-directory: regular files go to the I/O pool, links and special
+    // files are handled inline.
+    void entry(const string &src, const string &dst, const struct stat &st, Node *parent) {
+        if (S_ISREG(st.st_mode)) {
+            if (parent) ++parent->pending;
+            io_.submit([this, src, dst, st, parent] {
+                file(src, dst, st);
+                if (parent) finish(*parent);
+            });
+            return;
+        }
+        if (S_ISLNK(st.st_mode)) {
+            string target(static_cast<size_t>(st.st_size) + 1, '\0');
+            ssize_t n = readlink(src.c_str(), &target[0], target.size());
+            if (n < 0) { error(src, strerror(errno)); return; }
+            target.resize(static_cast<size_t>(n));
+            unlink(dst.c_str());
+            if (symlink(target.c_str(), dst.c_str()) != 0) { error(dst, strerror(errno)); return; }
+            if (preserve_) apply_meta(-1, dst, st, true);
+            return;
+        }
+        error(src, "skipping special file");
+    }
+
+    void file(const string &src, const string &dst, const struct stat &st) {
+        int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) { error(src, strerror(errno)); return; }
+        // truncated only once it is known not to be the source itself (cp f f, cp dir/f dir)
+        int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+        if (out < 0) { error(dst, strerror(errno)); close(in); return; }
+        struct stat is, os;
+        string why;
+        if (fstat(in, &is) != 0 || fstat(out, &os) != 0) why = strerror(errno);
+        else if (is.st_dev == os.st_dev && is.st_ino == os.st_ino) why = "is the same file as " + src;
+        else if (ftruncate(out, 0) != 0) why = strerror(errno);
+        if (!why.empty()) { error(dst, why); close(out); close(in); return; }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        struct stat written, now;
+        if (!copy_file_data(in, out, st, progress_ ? &progress_->done : nullptr)) error(dst, strerror(errno));
+        // a source that shrank mid-copy was padded back out to the old size by copy_file_data
+        else if (fstat(in, &now) != 0 || now.st_size != st.st_size) error(src, "changed size while being copied");
+        else if (fstat(out, &written) != 0 || written.st_size != st.st_size) error(dst, "size differs from source after copy");
+        else ++files_;
+        if (preserve_) apply_meta(out, dst, st, false);
+        if (close(out) != 0) error(dst, strerror(errno));
+        close(in);
+    }
+
+    void finish(Node &n) {
+        if (--n.pending) return;
+        if (preserve_) apply_meta(-1, n.dst, n.st, false);
+        if (n.parent) finish(*n.parent);
+    }
+#endif
+
+    void error(const string &path, const string &msg) {
+        ++errors_;
+        lock_guard<mutex> lk(out_mutex);
+        out.flush();
+        eprint_colored(MTColor::RED, string(who_) + ": " + path + ": " + msg + "\n");
+    }
+
+    bool preserve_;
+    const char *who_;
+    ProgressLine *progress_;
+#ifndef _WIN32
+    deque<Node> nodes_;
+    mutex nodes_m_;
+#endif
+    atomic<size_t> errors_{0}, files_{0};
+    WorkPool io_;
+};
+
+// -- tree removal ----------------------------------------------------------
+// rm -r / rmdir: the tree is walked in parallel and every non-directory is
+// unlinked with unlinkat() against the open directory fd as it is listed.
+// Each directory counts its unfinished parts (its listing, each
+// subdirectory) and is rmdir'ed by whichever task finishes the last one, so
+// leaf directories go concurrently and parents follow as soon as they empty.
+class TreeRemover {
+public:
+    // quiet: keep the first error for the caller instead of printing (background use)
+    TreeRemover(const char *who, atomic<uintmax_t> *count = nullptr, bool quiet = false)
+        : who_(who), count_(count ? count : &own_count_), quiet_(quiet) {}
+
+    // Removes path and everything below it; returns the number of entries removed.
+    uintmax_t remove(const string &path) {
+#ifdef _WIN32
+        error_code ec;
+        uintmax_t n = fs::remove_all(path, ec);
+        if (ec) error(path, ec.message());
+        return n == static_cast<uintmax_t>(-1) ? 0 : n;
+#else
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) { error(path, strerror(errno)); return 0; }
+        if (!S_ISDIR(st.st_mode)) {
+            if (unlink(path.c_str()) != 0) { error(path, strerror(errno)); return 0; }
+            return ++*count_;
+        }
+        nodes_.emplace_back();
+        nodes_.back().path = path;
+        WalkOptions opt; opt.who = who_;
+        // counted, and kept quiet in the background, like the remover's own errors
+        opt.on_error = [this](const string &path, const string &msg) { error(path, msg); };
+        TreeWalker w(opt, [this](WalkDir &d) { visit(d); }, nullptr, [this](void *ctx) { finish(*static_cast<Node*>(ctx)); });
+        w.run(path, &nodes_.front());
+        return count_->load();
+#endif
+    }
+
+    size_t errors() const { return errors_; }
+    string first_error() const { lock_guard<mutex> lk(m_); return first_error_; }
+
+private:
+#ifndef _WIN32
+    struct Node {
+        string path;
+        Node *parent = nullptr;
+        atomic<size_t> pending{1};
+    };
+
+    void visit(WalkDir &d) {
+        Node &n = *static_cast<Node*>(d.ctx);
+        uintmax_t gone = 0;
+        for (auto &e : d.entries) {
+            if (e.type == FileType::Dir) {
+                Node *k;
+                {
+                    lock_guard<mutex> lk(m_);
+                    nodes_.emplace_back();
+                    k = &nodes_.back();
+                }
+                k->path = d.child(e); k->parent = &n;
+                ++n.pending;
+                e.ctx = k;
+            } else if (unlinkat(d.fd, e.name.c_str(), 0) == 0) ++gone;
+            else error(d.child(e), strerror(errno));
+        }
+        *count_ += gone;
+    }
+
+    void finish(Node &n) {
+        if (--n.pending) return;
+        if (rmdir(n.path.c_str()) == 0) ++*count_;
+        else if (errno != ENOTEMPTY || errors_ == 0) error(n.path, strerror(errno));   // ENOTEMPTY just echoes an earlier failure
+        if (n.parent) finish(*n.parent);
+    }
+#endif
+
+    void error(const string &path, const string &msg) {
+        ++errors_;
+        if (quiet_) {
+            lock_guard<mutex> lk(m_);
+            if (first_error_.empty()) first_error_ = path + ": " + msg;
+            return;
+        }
+        lock_guard<mutex> lk(out_mutex);
+        out.flush();
+        eprint_colored(MTColor::RED, string(who_) + ": " + path + ": " + msg + "\n");
+    }
+
+    const char *who_;
+    atomic<uintmax_t> own_count_{0};
+    atomic<uintmax_t> *count_;
+    bool quiet_;
+    atomic<size_t> errors_{0};
+    mutable mutex m_;
+    string first_error_;
+#ifndef _WIN32
+    deque<Node> nodes_;
+#endif
+};
+
+// --async: the target is renamed to a hidden sibling (same directory, so the
+// same filesystem and an atomic step), the prompt comes straight back and a
+// thread deletes the renamed tree. Finished jobs are announced before the
+// next prompt, running ones are listed by `rmdir --status`, and exit waits
+// for whatever is still running.
+class BackgroundRemovals {
+public:
+    // Returns false (with errno set by rename) if the target could not be moved aside.
+    bool start(const string &target) {
+        static atomic<unsigned> seq{0};
+        fs::path t = fs::path(target);
+        while (t.has_parent_path() && !t.has_filename()) t = t.parent_path();   // "dir/" -> "dir"
+#ifdef _WIN32
+        auto pid = GetCurrentProcessId();
+#else
+        auto pid = getpid();
+#endif
+        string trash = (t.parent_path() / (".ct-trash-" + to_string(pid) + "-" + to_string(seq++) + "-" + t.filename().string())).string();
+        if (std::rename(t.string().c_str(), trash.c_str()) != 0) return false;
+        auto job = make_unique<Job>();
+        Job *j = job.get();
+        j->shown = target; j->trash = trash; j->started = chrono::steady_clock::now();
+        j->th = thread([j] {
+            TreeRemover r("rm", &j->removed, true);
+            r.remove(j->trash);
+            j->errors = r.errors();
+            j->error = r.first_error();
+            j->finished = chrono::steady_clock::now();
+            j->done = true;
+        });
+        lock_guard<mutex> lk(m_);
+        jobs_.push_back(move(job));
+        return true;
+    }
+
+    // Main thread, before each prompt.
+    void print_notices() {
+        lock_guard<mutex> lk(m_);
+        for (auto it = jobs_.begin(); it != jobs_.end();) {
+            Job &j = **it;
+            if (!j.done) { ++it; continue; }
+            j.th.join();
+            double secs = chrono::duration<double>(j.finished - j.started).count();
+            char buf[32]; snprintf(buf, sizeof buf, ", %.1f s)\n", secs);
+            if (j.errors) eprint_colored(MTColor::RED, "[rm] " + j.shown + ": " + to_string(j.errors) + " errors, first: " + j.error + " (left in " + j.trash + ")\n");
+            else cout << colorize(MTColor::GRAY, "[rm] removed " + j.shown + " (" + to_string(j.removed.load()) + " entries" + buf);
+            it = jobs_.erase(it);
+        }
+        cout.flush();
+    }
+
+    void status() {
+        lock_guard<mutex> lk(m_);
+        if (jobs_.empty()) { cout << "no background deletions\n"; return; }
+        for (auto &j : jobs_) {
+            double secs = chrono::duration<double>((j->done ? j->finished : chrono::steady_clock::now()) - j->started).count();
+            uintmax_t n = j->removed.load();
+            char buf[64]; snprintf(buf, sizeof buf, " entries in %.1f s (%.0f/s)", secs, secs > 0 ? n / secs : 0.0);
+            cout << "  " << j->shown << ": " << (j->done ? "done, " : "") << n << buf << '\n';
+        }
+    }
+
+    void join_all() {
+        {
+            lock_guard<mutex> lk(m_);
+            size_t running = 0;
+            for (auto &j : jobs_) running += !j->done;
+            if (running) cout << colorize(MTColor::GRAY, "waiting for " + to_string(running) + " background deletion(s)...\n") << flush;
+            for (auto &j : jobs_) j->th.join();
+            jobs_.clear();
+        }
+    }
+
+private:
+    struct Job {
+        string shown, trash, error;
+        atomic<uintmax_t> removed{0};
+        atomic<bool> done{false};
+        size_t errors = 0;
+        chrono::steady_clock::time_point started, finished;
+        thread th;
+    };
+    mutex m_;
+    vector<unique_ptr<Job>> jobs_;
+};
+static BackgroundRemovals bg_removals;
+
+// Apparent bytes of regular files under p (or of p itself), for progress totals.
+static uintmax_t tree_bytes(const string &p, const char *who) {
+    FileMeta m;
+    if (!stat_path(p, m, false)) return 0;
+    if (m.type != FileType::Dir) return m.type == FileType::Regular ? m.size : 0;
+    atomic<uintmax_t> total{0};
+    WalkOptions opt; opt.who = who;
+    walk_tree(p, opt, [&total](WalkDir &d) {
+        uintmax_t sum = 0;
+        FileMeta fm;
+        for (auto &e : d.entries)
+            if (e.type == FileType::Regular && stat_entry(d, e, fm)) sum += fm.size;
+        total += sum;
+    });
+    return total;
+}
+
+// -- prompt cache ----------------------------------------------------------
+// The prompt is rendered into one string and reused until something it shows
+// changes: cd/goto/setenv invalidate it, and the hostname is only re-read every
+// few seconds instead of once per line.
+static string prompt_cache;
+static string prompt_host;
+static bool prompt_valid = false;
+static chrono::steady_clock::time_point prompt_host_checked;
+
+static void invalidate_prompt() { prompt_valid = false; }
+
+static string current_hostname() {
+    char hostbuf[256] = {0};
+#ifdef _WIN32
+    DWORD len = sizeof(hostbuf);
+    if (!GetComputerNameA(hostbuf, &len)) hostbuf[0] = '\0';
+#else
+    if (gethostname(hostbuf, sizeof(hostbuf)) != 0) hostbuf[0] = '\0';
+#endif
+    return string(hostbuf);
+}
+
+static const string &render_prompt() {
+    auto now = chrono::steady_clock::now();
+    if (prompt_valid && now - prompt_host_checked > chrono::seconds(5)) {
+        prompt_host_checked = now;
+        if (current_hostname() != prompt_host) prompt_valid = false;
+    }
+    if (prompt_valid) return prompt_cache;
+    try {
+        string path = fs::current_path().string();
+        const char* user = getenv("USER");
+        string userstr = user ? user : "user";
+        prompt_host = current_hostname();
+        prompt_host_checked = now;
+        prompt_cache = colorize(MTColor::MINT_GREEN, userstr + "@" + prompt_host) + ":" + colorize(MTColor::CYAN, path) + " ";
+        if (color_stdout) prompt_cache += mt_code(MTColor::BOLD);
+        prompt_cache += colorize(MTColor::BRIGHT_GREEN, "> ");
+        prompt_valid = true;
+    } catch(...) {
+        // cwd vanished: show the bare prompt and retry next time
+        prompt_cache = colorize(MTColor::BRIGHT_GREEN, "> ");
+    }
+    return prompt_cache;
+}
+
+// -- core commands ---------------------------------------------------------
+
+// ls: one getdents pass for names and d_type, which is all a plain listing
+// needs for directories. Other entries get one stat (the executable bit, a
+// link's target type); -l gets one stat per entry. On Linux that stat is a statx
+// asking only for type, mode, size and mtime.
+static bool ls_stat(const WalkDir &d, const DirEntry &e, FileMeta &m) {
+#if defined(__linux__) && defined(STATX_TYPE)
+    struct statx sx;
+    const unsigned mask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+    // follow links like the listing always has; a dangling link describes itself
+    if (statx(d.fd, e.name.c_str(), AT_STATX_DONT_SYNC, mask, &sx) != 0 &&
+        statx(d.fd, e.name.c_str(), AT_STATX_DONT_SYNC | AT_SYMLINK_NOFOLLOW, mask, &sx) != 0) return false;
+    m.type = type_of_mode(sx.stx_mode);
+    m.mode = sx.stx_mode;
+    m.size = sx.stx_size;
+    m.mtime = int64_t(sx.stx_mtime.tv_sec) * 1000000000 + sx.stx_mtime.tv_nsec;
+    return true;
+#else
+    return stat_entry(d, e, m, true) || stat_entry(d, e, m, false);
+#endif
+}
+
+static void cmd_ls(const vector<string>& a) {
+    string p = ".";
+    bool longlist = false, reverse = false;
+    char key = 0;                             // 'S', 't', 'U' or 0 (name); the last one given wins
+    for (size_t i = 1; i < a.size(); ++i) {
+        const string &o = a[i];
+        if (o.size() > 1 && o[0] == '-' && o.find_first_not_of("lStrU", 1) == string::npos) {
+            for (char c : o.substr(1)) {
+                if (c == 'l') longlist = true;
+                else if (c == 'r') reverse = true;
+                else key = c;
+            }
+        } else p = o;
+    }
+    const bool by_size = key == 'S', by_time = key == 't', unsorted = key == 'U';
+    WalkDir d; d.path = p;
+#ifndef _WIN32
+    d.fd = open(p.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (d.fd < 0) { eprint_colored(MTColor::RED, "ls: " + p + ": " + strerror(errno) + "\n"); return; }
+#endif
+    // size and time keys come from the same stat that -l and the colours use
+    struct Row { DirEntry e; FileMeta m; bool have = false; };
+    const bool want_stat_all = longlist || by_size || by_time;
+    auto load = [&](DirEntry &&e) {
+        Row r; r.e = move(e);
+        r.have = (want_stat_all || r.e.type != FileType::Dir) && ls_stat(d, r.e, r.m);
+        return r;
+    };
+    auto print = [&](const Row &r) {
+        const DirEntry &e = r.e; const FileMeta &m = r.m; bool have = r.have;
+        if (longlist) {
+            // print perms (gray), size (orange), mtime(gray)
+            out.color(MTColor::GRAY) << perms_to_string(static_cast<fs::perms>(m.mode & 0777)) << ' ';
+            out.color(MTColor::ORANGE).pad(have && m.type == FileType::Regular ? m.size : 0, 8).color(MTColor::RESET) << ' ';
+            out.colored(MTColor::GRAY, time_string(static_cast<time_t>(m.mtime / 1000000000))) << ' ';
+        }
+        FileType t = e.type == FileType::Unknown && have ? m.type : e.type;
+        if (t == FileType::Dir || (e.type == FileType::Symlink && have && m.type == FileType::Dir)) out.colored(MTColor::BLUE, e.name) << '\n';
+        else if (t == FileType::Symlink) out.colored(MTColor::MAGENTA, e.name) << '\n';
+#ifdef _WIN32
+        else if (t == FileType::Regular && is_executable_file(d.child(e))) out.colored(MTColor::BRIGHT_GREEN, e.name) << '\n';
+#else
+        else if (t == FileType::Regular && have && (m.mode & 0111)) out.colored(MTColor::BRIGHT_GREEN, e.name) << '\n';
+#endif
+        else out << e.name << '\n';
+    };
+
+    error_code ec;
+    if (unsorted) {
+        // -U: printed in directory order as each getdents batch arrives; nothing is kept
+        if (!scan_dir(d, [&](DirEntry &&e) { print(load(move(e))); }, ec))
+            eprint_colored(MTColor::RED, "ls: " + p + ": " + ec.message() + "\n");
+    } else {
+        vector<Row> rows;
+        if (!scan_dir(d, [&](DirEntry &&e) { rows.push_back(load(move(e))); }, ec))
+            eprint_colored(MTColor::RED, "ls: " + p + ": " + ec.message() + "\n");
+        // keys are plain fields of Row, so a comparison never allocates
+        auto cmp = [&](const Row &x, const Row &y) {
+            if (by_size && x.m.size != y.m.size) return x.m.size > y.m.size;
+            if (by_time && x.m.mtime != y.m.mtime) return x.m.mtime > y.m.mtime;
+            return x.e.name < y.e.name;
+        };
+        if (reverse) sort(rows.begin(), rows.end(), [&](const Row &x, const Row &y) { return cmp(y, x); });
+        else sort(rows.begin(), rows.end(), cmp);
+        for (auto &r : rows) print(r);
+    }
+#ifndef _WIN32
+    close(d.fd);
+#endif
+}
+
+static void cmd_pwd(const vector<string>& a) {
+    try { cout << colorize(MTColor::MINT_GREEN, fs::current_path().string()) << '\n'; } catch(...) { eprint_colored(MTColor::RED, "?\n"); }
+}
+
+static void cmd_cd(const vector<string>& a) {
+    try { fs::current_path(a[1]); invalidate_prompt(); } catch (const exception &ex) { eprint_colored(MTColor::RED, string("cd: ") + ex.what() + '\n'); }
+}
+
+static void cmd_cat(const vector<string>& a) {
+    // raw bytes straight to fd 1, so anything buffered must go out first
+    out.flush();
+    for (size_t i = 1; i < a.size(); ++i) {
+#ifdef _WIN32
+        LineReader r(a[i]); if (!r.ok()) { eprint_colored(MTColor::RED, "cat: " + a[i] + ": cannot open\n"); continue; }
+        string_view blk; while (r.next_block(blk)) cout.write(blk.data(), static_cast<streamsize>(blk.size()));
+        cout.flush();
+#else
+        int fd = ::open(a[i].c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { eprint_colored(MTColor::RED, "cat: " + a[i] + ": " + strerror(errno) + "\n"); continue; }
+        if (!copy_fd(fd, 1, fd_is_tty(1))) eprint_colored(MTColor::RED, "cat: " + a[i] + ": " + strerror(errno) + "\n");
+        ::close(fd);
+#endif
+    }
+}
+
+static void cmd_edit(const vector<string>& a) {
+    string file = a[1];
+    const char* ed = getenv("EDITOR");
+    string cmd;
+    if (ed && strlen(ed)) cmd = string(ed) + " \"" + file + "\"";
+    else {
+        // try code, nano
+        if (system("command -v code >/dev/null 2>&1") == 0) cmd = "code \"" + file + "\"";
+        else cmd = "nano \"" + file + "\"";
+    }
+    system(cmd.c_str());
+}
+
+static void cmd_mkdir(const vector<string>& a) {
+    try {
+        if (a.size() > 1 && a[1] == "-p") {
+            if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "mkdir -p: missing path\n"); return; }
+            fs::create_directories(a[2]);
+            cout << "created\n";
+        } else {
+            if (fs::create_directory(a[1])) cout << "created\n"; else eprint_colored(MTColor::RED, "mkdir: failed\n");
+        }
+    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("mkdir: ") + ex.what() + '\n'); }
+}
+
+// Shared by rm -r and rmdir: refuses /, . and .., then removes in the
+// foreground (with a progress line on a terminal) or hands off to the
+// background. Returns the entries removed, or -1 if it failed (errors were
+// already printed) or went to the background.
+static intmax_t remove_tree(const char *who, const string &target, bool async) {
+    string name = fs::path(target).filename().string();
+    error_code ec;
+    if (name == "." || name == ".." || fs::equivalent(target, "/", ec) || fs::equivalent(target, fs::current_path(ec), ec)) {
+        eprint_colored(MTColor::RED, string(who) + ": refusing to remove " + target + "\n");
+        return -1;
+    }
+    if (async) {
+        if (!bg_removals.start(target)) { eprint_colored(MTColor::RED, string(who) + ": " + target + ": " + strerror(errno) + "\n"); return -1; }
+        cout << colorize(MTColor::GRAY, "removing " + target + " in the background\n");
+        return -1;
+    }
+    ProgressLine bar(who, fd_is_tty(2), false);
+    TreeRemover r(who, &bar.done);
+    uintmax_t n = r.remove(target);
+    bar.stop();
+    return r.errors() ? -1 : static_cast<intmax_t>(n);
+}
+
+static void cmd_rm(const vector<string>& a) {
+    bool recursive = false, force = false, async = false;
+    vector<string> targets;
+    for (size_t i = 1; i < a.size(); ++i) {
+        const string &o = a[i];
+        if (o == "--async") async = true;
+        else if (o.size() > 1 && o[0] == '-' && o.find_first_not_of("rRf", 1) == string::npos) {
+            recursive |= o.find_first_of("rR") != string::npos;
+            force |= o.find('f') != string::npos;
+        } else targets.push_back(o);
+    }
+    if (targets.empty()) { if (!force) eprint_colored(MTColor::YELLOW, "rm: usage rm [-rf] [--async] <path>...\n"); return; }
+    bool ok = true, any = false;
+    for (const string &t : targets) {
+        error_code ec;
+        fs::file_status st = fs::symlink_status(t, ec);
+        if (force && !fs::exists(st)) continue;   // -f: a missing operand is not an error
+        if (!recursive && fs::is_directory(st) && !fs::is_empty(t, ec)) {
+            eprint_colored(MTColor::RED, "rm: " + t + ": is a directory (use -r)\n");
+            ok = false;
+            continue;
+        }
+        if (async) { remove_tree("rm", t, true); continue; }
+        if (recursive) {
+            if (remove_tree("rm", t, false) >= 0) any = true; else ok = false;
+            continue;
+        }
+        if (fs::remove(t, ec)) { any = true; continue; }
+        eprint_colored(MTColor::RED, "rm: " + t + ": " + (ec ? ec.message() : string(strerror(ENOENT))) + '\n');
+        ok = false;
+    }
+    if (ok && any) cout << "removed\n";
+}
+
+static void cmd_rmdir(const vector<string>& a) {
+    bool async = false;
+    string target;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "--async") async = true;
+        else if (a[i] == "--status") { bg_removals.status(); return; }
+        else target = a[i];
+    }
+    if (target.empty()) { eprint_colored(MTColor::YELLOW, "rmdir: usage rmdir [--async] <dir>\n"); return; }
+    intmax_t n = remove_tree("rmdir", target, async);
+    if (n >= 0) cout << "removed " << n << " entries\n";
+}
+
+static void cmd_touch(const vector<string>& a) {
+    ofstream f(a[1], ios::app); if (!f) eprint_colored(MTColor::RED, "touch: cannot create\n");
+}
+
+static void cmd_cp(const vector<string>& a) {
+    bool preserve = false, progress = false;
+    vector<string> args;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "-p") preserve = true;
+        else if (a[i] == "--progress") progress = true;
+        else args.push_back(a[i]);
+    }
+    if (args.size() != 2) { eprint_colored(MTColor::YELLOW, "cp: usage cp [-p] [--progress] <src> <dst>\n"); return; }
+    string src = args[0], dst = args[1];
+    error_code ec;
+    // a file copied onto a directory lands inside it
+    if (!fs::is_directory(src, ec) && fs::is_directory(dst, ec)) dst = (fs::path(dst) / fs::path(src).filename()).string();
+    ProgressLine bar("cp", progress);
+    if (progress) bar.total = tree_bytes(src, "cp");
+    TreeCopier c(preserve, progress ? &bar : nullptr);
+    bool ok = c.copy(src, dst);
+    bar.stop();
+    if (ok) cout << "copied\n";
+}
+
+// mv is a rename; across filesystems (EXDEV) it becomes a parallel copy that
+// keeps metadata, checks each file's size, and removes the source only if the
+// whole copy succeeded.
+static void cmd_mv(const vector<string>& a) {
+    bool progress = false;
+    vector<string> args;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "--progress") progress = true;
+        else args.push_back(a[i]);
+    }
+    if (args.size() != 2) { eprint_colored(MTColor::YELLOW, "mv: usage mv [--progress] <src> <dst>\n"); return; }
+    string src = args[0], dst = args[1];
+    error_code ec;
+    if (fs::is_directory(dst, ec) && !fs::equivalent(src, dst, ec)) dst = (fs::path(dst) / fs::path(src).filename()).string();
+    fs::rename(src, dst, ec);
+    if (!ec) { cout << "moved\n"; return; }
+    if (ec != errc::cross_device_link) { eprint_colored(MTColor::RED, "mv: " + src + ": " + ec.message() + '\n'); return; }
+
+    auto t0 = chrono::steady_clock::now();
+    const bool show = progress || fd_is_tty(2);         // a long copy on a terminal always shows its rate
+    ProgressLine bar("mv", show);
+    if (show) bar.total = tree_bytes(src, "mv");
+    TreeCopier c(true, &bar, "mv");
+    bool ok = c.copy(src, dst);
+    bar.stop();
+    if (!ok) { eprint_colored(MTColor::RED, "mv: copy incomplete; " + src + " left in place\n"); return; }
+    TreeRemover rm("mv");
+    rm.remove(src);
+    if (rm.errors()) { eprint_colored(MTColor::RED, "mv: copied, but " + src + " could not be fully removed\n"); return; }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    double bytes = static_cast<double>(bar.done.load());
+    char rate[64]; snprintf(rate, sizeof rate, " in %.1f s (", secs);
+    cout << "moved across filesystems: " << human_bytes(bytes) << rate << human_bytes(secs > 0 ? bytes / secs : bytes) << "/s)\n";
+}
+
+// find: the expression is a conjunction, parsed once. Tests are split by cost:
+// name globs and -type run on what the directory listing already gives us,
+// and only entries that pass them are stat'ed for -size/-mtime/-mmin/-newer.
+// -prune GLOB and -maxdepth cut whole subtrees before they are opened. A bare
+// -prune is POSIX find's action: whatever the other tests match is printed
+// but not descended into (the expression being a conjunction, its position
+// does not matter).
+struct FindQuery {
+    vector<Glob> names;                  // -name / -iname
+    vector<Glob> prune;                  // -prune GLOB: directories not descended into (nor listed)
+    bool prune_matches = false;          // bare -prune
+    FileType type = FileType::Unknown;   // -type; Unknown = any
+    int min_depth = 0, max_depth = -1;
+    struct Cmp { int sign; int64_t n; };  // +n (more than), -n (less than), n (exactly)
+    optional<Cmp> size, mtime_days, mtime_mins;
+    int64_t size_unit = 512;
+    optional<int64_t> newer;             // mtime of the -newer reference
+    int64_t now = 0;
+
+    bool needs_stat() const { return size || mtime_days || mtime_mins || newer; }
+
+    static bool cmp(const Cmp &c, int64_t v) { return c.sign > 0 ? v > c.n : c.sign < 0 ? v < c.n : v == c.n; }
+
+    bool cheap(string_view name, FileType t, int depth) const {
+        if (depth < min_depth) return false;
+        if (type != FileType::Unknown && t != type) return false;
+        for (auto &g : names) if (!g.match(name)) return false;
+        return true;
+    }
+    bool costly(const FileMeta &m) const {
+        // sizes rounded up to whole units and -mtime ages truncated to whole days, as in POSIX find
+        if (size && !cmp(*size, static_cast<int64_t>((m.size + size_unit - 1) / size_unit))) return false;
+        int64_t age = now - m.mtime;
+        if (mtime_days && !cmp(*mtime_days, age / (int64_t(86400) * 1000000000))) return false;
+        if (mtime_mins) {
+            const int64_t min = int64_t(60) * 1000000000;
+            const Cmp &c = *mtime_mins;
+            // +n / -n compare the exact age; plain n means "within the n-th minute"
+            if (!(c.sign ? cmp(Cmp{ c.sign, c.n * min }, age) : (age + min - 1) / min == c.n)) return false;
+        }
+        if (newer && m.mtime <= *newer) return false;
+        return true;
+    }
+    bool pruned(string_view name) const {
+        for (auto &g : prune) if (g.match(name)) return true;
+        return false;
+    }
+
+    // Parses a[i..]; on error returns the message.
+    optional<string> parse(const vector<string> &a, size_t i) {
+        now = file_now();
+        auto num = [](string_view v, Cmp &c) {
+            c.sign = v.empty() ? 0 : v[0] == '+' ? 1 : v[0] == '-' ? -1 : 0;
+            if (c.sign) v.remove_prefix(1);
+            auto r = from_chars(v.data(), v.data() + v.size(), c.n);
+            return r.ec == errc() && r.ptr != v.data() ? static_cast<size_t>(r.ptr - v.data()) + (c.sign ? 1 : 0) : size_t(0);
+        };
+        for (; i < a.size(); ++i) {
+            const string &p = a[i];
+            if (p == "-prune" && (i + 1 >= a.size() || a[i + 1].empty() || a[i + 1][0] == '-')) { prune_matches = true; continue; }
+            if (i + 1 >= a.size()) return "missing argument to " + p;
+            const string &v = a[++i];
+            Cmp c;
+            if (p == "-name" || p == "-iname") names.emplace_back(v, p == "-iname");
+            else if (p == "-prune") prune.emplace_back(v);
+            else if (p == "-type") {
+                if (v == "f") type = FileType::Regular;
+                else if (v == "d") type = FileType::Dir;
+                else if (v == "l") type = FileType::Symlink;
+                else return "-type takes f, d or l";
+            } else if (p == "-maxdepth" || p == "-mindepth") {
+                size_t used = num(v, c);
+                if (!used || used != v.size() || c.sign) return "bad depth " + v;
+                (p == "-maxdepth" ? max_depth : min_depth) = static_cast<int>(c.n);
+            } else if (p == "-size") {
+                size_t used = num(v, c);
+                if (!used || used + 1 < v.size()) return "bad size " + v;
+                switch (used < v.size() ? v[used] : 'b') {
+                    case 'b': size_unit = 512; break;
+                    case 'c': size_unit = 1; break;
+                    case 'k': size_unit = 1024; break;
+                    case 'M': size_unit = 1024 * 1024; break;
+                    case 'G': size_unit = int64_t(1) << 30; break;
+                    default: return "bad size unit in " + v;
+                }
+                size = c;
+            } else if (p == "-mtime" || p == "-mmin") {
+                size_t used = num(v, c);
+                if (!used || used != v.size()) return "bad time " + v;
+                (p == "-mtime" ? mtime_days : mtime_mins) = c;
+            } else if (p == "-newer") {
+                FileMeta m;
+                if (!stat_path(v, m)) return v + ": " + strerror(errno);
+                newer = m.mtime;
+            } else return "unknown predicate " + p;
+        }
+        return nullopt;
+    }
+};
+
+static void cmd_find(const vector<string>& a) {
+    size_t i = 1;
+    bool follow = a.size() > 1 && a[1] == "-L";
+    if (follow) ++i;
+    string p = ".";
+    if (i < a.size() && (a[i].empty() || a[i][0] != '-')) p = a[i++];
+    FindQuery q;
+    if (auto err = q.parse(a, i)) { eprint_colored(MTColor::YELLOW, "find: " + *err + '\n'); return; }
+    FileMeta root;
+    if (!stat_path(p, root, follow)) { eprint_colored(MTColor::RED, "find: " + p + ": " + strerror(errno) + '\n'); return; }
+    string root_name = fs::path(p).filename().string();
+    if (root_name.empty()) root_name = p;
+    bool hit = q.cheap(root_name, root.type, 0) && q.costly(root);
+    if (hit) out << p << '\n';
+    if (root.type != FileType::Dir || q.max_depth == 0 || (hit && q.prune_matches)) return;
+    WalkOptions opt; opt.who = "find"; opt.follow_links = follow;
+    // each directory's matches are gathered privately and written in one piece
+    walk_tree(p, opt, [&q, follow](WalkDir &d) {
+        string buf;
+        const int depth = d.depth + 1;
+        FileMeta m;
+        for (auto &e : d.entries) {
+            if (e.descend && (q.pruned(e.name) || (q.max_depth >= 0 && depth >= q.max_depth))) {
+                e.descend = false;
+                if (q.pruned(e.name)) continue;
+            }
+            if (!q.cheap(e.name, e.type, depth)) continue;
+            if (q.needs_stat() && (!stat_entry(d, e, m, follow) || !q.costly(m))) continue;
+            if (q.prune_matches) e.descend = false;
+            (buf += d.child(e)) += '\n';
+        }
+        if (buf.empty()) return;
+        lock_guard<mutex> lk(out_mutex);
+        out << buf;
+    });
+}
+
+// tree: the walk fills one node per directory on the pool while the calling
+// thread prints. The printer goes depth-first in sorted order and only blocks
+// on the node it needs next, so output is deterministic yet starts as soon as
+// the first directories are listed. With --du a directory's line waits for
+// its whole subtree, whose sizes are rolled up as subtrees complete.
+struct TreeNode {
+    string name;
+    bool dir = false;
+    uintmax_t size = 0;                      // files: apparent size; directories: total below (--du),
+                                             // hard links counted once per name as tree(1) does
+    TreeNode *parent = nullptr;
+    vector<TreeNode> kids;                   // directories first, then files, each sorted by name
+    // progress, guarded by TreeView::m_
+    bool listed = false, done = false;
+    size_t pending = 1;                      // own listing + subdirectories still being walked
+};
+
+class TreeView {
+public:
+    TreeView(int max_level, bool du) : max_level_(max_level), du_(du) {}
+
+    void run(const string &p) {
+        TreeNode root; root.name = p; root.dir = true;
+        WalkOptions opt; opt.who = "tree";
+        TreeWalker w(opt, [this](WalkDir &d) { visit(d); }, nullptr, [this](void *ctx) { leave(*static_cast<TreeNode*>(ctx)); });
+        w.start(p, &root);
+        emit(p + '\n');
+        print(root, "", 0);
+        w.wait();
+        if (du_) emit(size_tag(root.size) + "total\n");
+    }
+
+private:
+    bool shown(int level) const { return max_level_ < 0 || level <= max_level_; }
+
+    void visit(WalkDir &d) {
+        TreeNode &n = *static_cast<TreeNode*>(d.ctx);
+        const int level = d.depth + 1;
+        uintmax_t files = 0;
+        size_t subdirs = 0;
+        FileMeta m;
+        // --du must see everything below; otherwise stop where printing stops
+        if (!du_ && !(max_level_ < 0 || level < max_level_))
+            for (auto &e : d.entries) e.descend = false;
+        // below the printed levels only subdirectories are kept, for their sizes
+        const bool keep_all = shown(level);
+        if (keep_all)
+            sort(d.entries.begin(), d.entries.end(), [](const DirEntry &x, const DirEntry &y) {
+                bool xd = x.type == FileType::Dir, yd = y.type == FileType::Dir;
+                return xd != yd ? xd : x.name < y.name;
+            });
+        n.kids.resize(keep_all ? d.entries.size()   // sized once, so ctx pointers stay valid
+                               : static_cast<size_t>(count_if(d.entries.begin(), d.entries.end(), [](const DirEntry &e) { return e.descend; })));
+        size_t next = 0;
+        for (auto &e : d.entries) {
+            uintmax_t size = 0;
+            if (du_ && e.type != FileType::Dir && stat_entry(d, e, m)) { size = m.size; files += size; }
+            if (!keep_all && !e.descend) continue;
+            TreeNode &k = n.kids[next++];
+            k.name = e.name;
+            k.dir = e.type == FileType::Dir;
+            k.size = size;
+            k.parent = &n;
+            e.ctx = &k;
+            subdirs += e.descend;
+        }
+        lock_guard<mutex> lk(m_);
+        n.size += files;
+        n.pending += subdirs;
+    }
+
+    void leave(TreeNode &n) {
+        lock_guard<mutex> lk(m_);
+        n.listed = true;
+        finish(n);
+        cv_.notify_all();
+    }
+
+    // m_ held. A directory is done once its listing and all its subdirectories are.
+    void finish(TreeNode &n) {
+        if (--n.pending) return;
+        n.done = true;
+        if (n.parent) { n.parent->size += n.size; finish(*n.parent); }
+    }
+
+    template <typename Pred>
+    void await(Pred ready) {
+        unique_lock<mutex> lk(m_);
+        if (ready()) return;
+        lk.unlock();
+        { lock_guard<mutex> olk(out_mutex); out.flush(); }   // show what we have before blocking
+        lk.lock();
+        cv_.wait(lk, ready);
+    }
+
+    void print(TreeNode &n, const string &prefix, int level) {
+        await([&] { return n.listed; });
+        if (!shown(level + 1)) return;
+        for (size_t i = 0; i < n.kids.size(); ++i) {
+            TreeNode &k = n.kids[i];
+            bool last = i + 1 == n.kids.size();
+            if (du_ && k.dir) await([&] { return k.done; });
+            string line = prefix + (last ? "└── " : "├── ");
+            if (du_) line += size_tag(k.size);
+            line += k.dir ? colorize(MTColor::BLUE, k.name) : k.name;
+            emit(line += '\n');
+            if (k.dir && shown(level + 2)) print(k, prefix + (last ? "    " : "│   "), level + 1);
+        }
+        // nothing below is touched once the subtree is done; release it as we go
+        await([&] { return n.done; });
+        vector<TreeNode>().swap(n.kids);
+    }
+
+    static string size_tag(uintmax_t bytes) {
+        char buf[32];
+        snprintf(buf, sizeof buf, "[%7juK]  ", static_cast<uintmax_t>((bytes + 1023) / 1024));
+        return colorize(MTColor::GRAY, buf);
+    }
 
-static void print_tree(const fs::path &root, const string &prefix = "") {
-    vector<fs::path> dirs, files;
-    for (auto &e : fs::directory_iterator(root)) { if (fs::is_directory(e)) dirs.push_back(e.path()); else files.push_back(e.path()); }
-    sort(dirs.begin(), dirs.end()); sort(files.begin(), files.end());
-    for (size_t i = 0; i < dirs.size(); ++i) { bool last = (i+1==dirs.size()) && files.empty(); cout << prefix << (last?"└── ":"├── ") << colorize(MTColor::BLUE, dirs[i].filename().string()) << '\n'; print_tree(dirs[i], prefix + (last?"    ":"│   ")); }
-    for (size_t i = 0; i < files.size(); ++i) cout << prefix << ((i+1==files.size())?"└── ":"├── ") << files[i].filename().string() << '\n';
-}
+    void emit(const string &s) { lock_guard<mutex> lk(out_mutex); out << s; }
+
+    int max_level_;
+    bool du_;
+    mutex m_;
+    condition_variable cv_;
+};
 
 static void cmd_tree(const vector<string>& a) {
-    string p = "."; if (a.size() > 1) p = a[1]; try { cout << p << '\n'; print_tree(p); } catch (const exception &ex) { eprint_colored(MTColor::RED, string("tree: ") + ex.what() + '\n'); }
+    string p = ".";
+    int level = -1;
+    bool du = false;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "--du") du = true;
+        else if (a[i] == "-L" && i + 1 < a.size()) {
+            const string &v = a[++i];
+            auto r = from_chars(v.data(), v.data() + v.size(), level);
+            if (r.ec != errc() || r.ptr != v.data() + v.size() || level < 1) { eprint_colored(MTColor::YELLOW, "tree: -L needs a level >= 1\n"); return; }
+        }
+        else p = a[i];
+    }
+    FileMeta m;
+    if (!stat_path(p, m) || m.type != FileType::Dir) { eprint_colored(MTColor::RED, "tree: " + p + ": not a directory\n"); return; }
+    TreeView(level, du).run(p);
 }
 
 static void cmd_ps(const vector<string>& a) {
@@ -381,69 +2708,494 @@ static void cmd_echo(const vector<string>& a) {
     for (size_t i = 1; i < a.size(); ++i) { if (i > 1) cout << ' '; cout << a[i]; } cout << '\n';
 }
 
+// Fixed string or -E regex; for a regex, `lit` holds its required literal
+// and only lines containing it reach the DFA.
+struct GrepPattern {
+    GrepPattern(const string &pat, bool ere)
+        : re(ere ? optional<Regex>(in_place, pat) : nullopt), lit(re ? string_view(re->required_literal()) : string_view(pat)) {}
+    optional<Regex> re;
+    Searcher lit;
+};
+
+// Calls emit(lineno, line) for every matching line. Chunks are searched
+// whole; line boundaries and numbers are only worked out around a hit.
+template <typename Emit>
+static void grep_scan(LineReader &r, GrepPattern &pat, Emit &&emit) {
+    const bool prefilter = !pat.re || pat.lit.size() > 0;
+    string_view chunk; size_t lineno = 1;
+    while (r.next_chunk(chunk)) {
+        const char *p = chunk.data(), *end = p + chunk.size();
+        while (p < end) {
+            const char *ls = p, *hit = p;
+            if (prefilter) {
+                size_t m = pat.lit.find(p, static_cast<size_t>(end - p));
+                if (m == static_cast<size_t>(end - p)) { lineno += count_byte(p, m, '\n'); break; }
+                hit = ls = p + m;
+                while (ls > p && ls[-1] != '\n') --ls;
+            }
+            const char *le = static_cast<const char*>(memchr(hit, '\n', static_cast<size_t>(end - hit)));
+            if (!le) le = end;
+            lineno += count_byte(p, static_cast<size_t>(ls - p), '\n');
+            if (!pat.re || pat.re->match(ls, static_cast<size_t>(le - ls))) emit(lineno, string_view(ls, static_cast<size_t>(le - ls)));
+            ++lineno;
+            p = le < end ? le + 1 : end;
+        }
+    }
+}
+
+static void grep_emit(string &dst, string_view path, size_t lineno, string_view line) {
+    if (!path.empty()) {
+        if (color_stdout) dst += mt_code(MTColor::CYAN);
+        dst += path;
+        if (color_stdout) dst += mt_code(MTColor::RESET);
+        dst += ':';
+    }
+    if (color_stdout) dst += mt_code(MTColor::MAGENTA);
+    char tmp[24]; auto r = to_chars(tmp, tmp + sizeof(tmp), lineno);
+    dst.append(tmp, r.ptr).append(": ");
+    if (color_stdout) dst += mt_code(MTColor::RESET);
+    dst.append(line) += '\n';
+}
+
+// grep -r: one pool task per directory and per file. Each file's matches are
+// collected privately and written in one piece, so files never interleave.
+// Files with a NUL in their first block are treated as binary and skipped;
+// .gitignore files are honored and .git directories never entered.
+struct GrepTree {
+    explicit GrepTree(const GrepPattern &p) : per_worker(pool.size(), p) {}
+    WorkPool pool;
+    vector<GrepPattern> per_worker;    // regex DFA caches are not shared
+
+    void file(const string &path) {
+        LineReader r(path);
+        string_view head = r.peek();
+        if (memchr(head.data(), '\0', min<size_t>(head.size(), 8192))) return;
+        string buf;
+        grep_scan(r, per_worker[static_cast<size_t>(WorkPool::worker_index())], [&](size_t lineno, string_view line) {
+            grep_emit(buf, path, lineno, line);
+        });
+        if (r.error()) { lock_guard<mutex> lk(out_mutex); out.flush(); eprint_colored(MTColor::RED, "grep: " + path + ": " + strerror(r.error()) + "\n"); return; }
+        if (buf.empty()) return;
+        lock_guard<mutex> lk(out_mutex);
+        out << buf;
+    }
+
+    void dir(const string &path, shared_ptr<const IgnoreRules> ign) {
+        ign = IgnoreRules::load(path, move(ign));
+        error_code ec;
+        fs::directory_iterator it(path, ec), end;
+        if (ec) { lock_guard<mutex> lk(out_mutex); eprint_colored(MTColor::RED, "grep: " + path + ": " + ec.message() + "\n"); return; }
+        for (; it != end; it.increment(ec)) {
+            if (ec) break;
+            const fs::directory_entry &e = *it;
+            string name = e.path().filename().string();
+            string child = e.path().string();
+            if (e.is_symlink(ec)) continue;
+            bool is_dir = e.is_directory(ec);
+            if (is_dir && name == ".git") continue;
+            if (IgnoreRules::ignored(ign.get(), child, name, is_dir)) continue;
+            if (is_dir) pool.submit([this, child, ign] { dir(child, ign); });
+            else if (e.is_regular_file(ec)) pool.submit([this, child] { file(child); });
+        }
+    }
+};
+
 static void cmd_grep(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "grep: usage grep <pattern> <file>\n"); return; }
-    ifstream f(a[2]); if (!f) { eprint_colored(MTColor::RED, "grep: cannot open file\n"); return; }
-    string line; size_t lineno = 1;
-    while (getline(f, line)) { if (line.find(a[1]) != string::npos) cout << colorize(MTColor::MAGENTA, to_string(lineno) + ": ") << line << '\n'; ++lineno; }
+    size_t i = 1; bool ere = false, recursive = false;
+    for (; i < a.size() && a[i].size() > 1 && a[i][0] == '-' && a[i].find_first_not_of("Er", 1) == string::npos; ++i) {
+        ere |= a[i].find('E') != string::npos;
+        recursive |= a[i].find('r') != string::npos;
+    }
+    if (a.size() - i < 2) { eprint_colored(MTColor::YELLOW, "grep: usage grep [-E] [-r] <pattern> <file|dir>\n"); return; }
+    const string &target = a[i + 1];
+    try {
+        GrepPattern pat(a[i], ere);
+        if (recursive) {
+            GrepTree t(pat);
+            error_code ec;
+            if (fs::is_directory(target, ec)) t.pool.submit([&t, &target] { t.dir(target, nullptr); });
+            else t.pool.submit([&t, &target] { t.file(target); });
+            t.pool.wait();
+            return;
+        }
+        if (fs::is_directory(target)) { eprint_colored(MTColor::RED, "grep: " + target + ": is a directory (use -r)\n"); return; }
+        LineReader r(target);
+        grep_scan(r, pat, [](size_t lineno, string_view line) {
+            out.color(MTColor::MAGENTA) << lineno << ": "; out.color(MTColor::RESET) << line << '\n';
+        });
+        if (r.error()) { out.flush(); eprint_colored(MTColor::RED, "grep: " + target + ": " + strerror(r.error()) + "\n"); }
+    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("grep: ") + ex.what() + '\n'); }
+}
+
+// Counts one file. -c alone on a regular file is answered from its size;
+// -l alone only counts newlines. Returns 0 or the errno that stopped it.
+static int wc_file(const string &path, bool want_l, bool want_w, bool want_c, WcCounts &c) {
+    if (want_c && !want_l && !want_w) {
+        error_code ec;
+        if (fs::is_regular_file(path, ec)) { c.bytes = fs::file_size(path, ec); if (!ec) return 0; }
+    }
+    LineReader r(path);
+    bool prev_space = true;
+    string_view blk;
+    while (r.next_block(blk)) {
+        c.bytes += blk.size();
+        if (want_w) wc_block(blk.data(), blk.size(), prev_space, c);
+        else c.lines += count_byte(blk.data(), blk.size(), '\n');
+    }
+    return r.error();
 }
 
 static void cmd_wc(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "wc: missing file\n"); return; }
-    ifstream f(a[1]); if (!f) { eprint_colored(MTColor::RED, "wc: cannot open file\n"); return; }
-    size_t L=0,W=0,C=0; string line;
-    while (getline(f, line)) {
-        ++L; C += line.size() + 1;
-        istringstream iss(line); string w; while (iss >> w) ++W;
+    bool l = false, w = false, c = false;
+    vector<string> files;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i].size() > 1 && a[i][0] == '-' && a[i].find_first_not_of("lwc", 1) == string::npos) {
+            l |= a[i].find('l') != string::npos; w |= a[i].find('w') != string::npos; c |= a[i].find('c') != string::npos;
+        } else files.push_back(a[i]);
+    }
+    if (files.empty()) { eprint_colored(MTColor::YELLOW, "wc: missing file\n"); return; }
+    if (!l && !w && !c) l = w = c = true;
+
+    vector<WcCounts> res(files.size());
+    vector<int> err(files.size());
+    if (files.size() == 1) err[0] = wc_file(files[0], l, w, c, res[0]);
+    else {
+        WorkPool pool(min<unsigned>(thread::hardware_concurrency(), static_cast<unsigned>(files.size())));
+        for (size_t i = 0; i < files.size(); ++i) pool.submit([&, i] { err[i] = wc_file(files[i], l, w, c, res[i]); });
+        pool.wait();
+    }
+
+    WcCounts total;
+    auto row = [&](const WcCounts &r, const string &name) {
+        if (l) out << r.lines << ' ';
+        if (w) out << r.words << ' ';
+        if (c) out << r.bytes << ' ';
+        out << name << '\n';
+    };
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (err[i]) { out.flush(); eprint_colored(MTColor::RED, "wc: " + files[i] + ": " + strerror(err[i]) + "\n"); continue; }
+        row(res[i], files[i]);
+        total.lines += res[i].lines; total.words += res[i].words; total.bytes += res[i].bytes;
     }
-    cout << L << " " << W << " " << C << " " << a[1] << '\n';
+    if (files.size() > 1) row(total, "total");
 }
 
 static void cmd_head(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "head: missing file\n"); return; }
-    ifstream f(a[1]); if (!f) { eprint_colored(MTColor::RED, "head: cannot open file\n"); return; }
-    string line; int n = 0; while (n < 10 && getline(f, line)) { cout << line << '\n'; ++n; }
+    LineReader r(a[1], 1 << 16);
+    string_view line; int n = 0; while (n < 10 && r.next(line)) { out << line << '\n'; ++n; }
+    if (r.error()) { out.flush(); eprint_colored(MTColor::RED, "head: " + a[1] + ": " + strerror(r.error()) + "\n"); }
 }
 
-static void cmd_tail(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "tail: missing file\n"); return; }
-    ifstream f(a[1]); if (!f) { eprint_colored(MTColor::RED, "tail: cannot open file\n"); return; }
-    vector<string> buf; string line; while (getline(f, line)) { buf.push_back(line); if (buf.size() > 10) buf.erase(buf.begin()); }
-    for (auto &l : buf) cout << l << '\n';
+
+// Offset at which the last `count` lines (or bytes) of a seekable stream of
+// `size` bytes begin. Lines are found by reading backwards from the end in
+// blocks, so only the tail of the file is ever read.
+static uintmax_t tail_offset(istream &f, uintmax_t size, uintmax_t count, bool bytes) {
+    if (bytes) return size > count ? size - count : 0;
+    if (count == 0) return size;
+    const uintmax_t block = 1 << 16;
+    unique_ptr<char[]> buf(new char[block]);
+    uintmax_t pos = size, found = 0;
+    while (pos > 0) {
+        uintmax_t len = min(block, pos);
+        pos -= len;
+        f.seekg(static_cast<streamoff>(pos));
+        if (!f.read(buf.get(), static_cast<streamsize>(len))) return 0;
+        for (uintmax_t i = len; i-- > 0; ) {
+            if (buf[i] != '\n' || pos + i + 1 == size) continue;   // ignore the final terminator
+            if (++found == count) return pos + i + 1;
+        }
+    }
+    return 0;
 }
 
-static void cmd_tailf(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "tail -f: missing file\n"); return; }
-    const string fname = a[1];
-    try {
-        std::ifstream file(fname, std::ios::binary);
-        if (!file) { eprint_colored(MTColor::RED, "tail -f: cannot open file\n"); return; }
+// -- follow mode -----------------------------------------------------------
+// tail -f sleeps in the kernel until the file changes: inotify on Linux,
+// a 200 ms poll elsewhere or when inotify is unavailable. Ctrl-C ends the
+// follow and returns to the prompt instead of killing the terminal.
+static volatile sig_atomic_t follow_interrupted = 0;
+static void follow_on_sigint(int) { follow_interrupted = 1; }
+
+class SigintScope {
+public:
+    SigintScope() {
+        follow_interrupted = 0;
+#ifdef _WIN32
+        prev_ = signal(SIGINT, follow_on_sigint);
+#else
+        struct sigaction sa{};
+        sa.sa_handler = follow_on_sigint;   // no SA_RESTART: poll() returns EINTR
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, &prev_);
+#endif
+    }
+    ~SigintScope() {
+#ifdef _WIN32
+        signal(SIGINT, prev_);
+#else
+        sigaction(SIGINT, &prev_, nullptr);
+#endif
+    }
+private:
+#ifdef _WIN32
+    void (*prev_)(int);
+#else
+    struct sigaction prev_;
+#endif
+};
+
+// Blocks until a watched file may have changed. wait() returns false once
+// Ctrl-C was pressed.
+class ChangeWaiter {
+public:
+    explicit ChangeWaiter(bool by_name) : by_name_(by_name) {
+#ifdef __linux__
+        ifd_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+#endif
+    }
+    ~ChangeWaiter() {
+#ifdef __linux__
+        if (ifd_ >= 0) ::close(ifd_);
+#endif
+    }
+    ChangeWaiter(const ChangeWaiter&) = delete;
+    ChangeWaiter &operator=(const ChangeWaiter&) = delete;
+
+    // Watches the file and, when following by name, its directory, so a
+    // rotated-in replacement wakes us too. Call again after reopening a path,
+    // passing the previous watch (returned here) so it is dropped. A path
+    // that cannot be watched makes wait() also wake every 200 ms; the other
+    // files keep their watches.
+    int watch(const string &path, int old_wd = -1) {
+#ifdef __linux__
+        if (ifd_ < 0) return -1;
+        int wd = inotify_add_watch(ifd_, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+        if (old_wd >= 0 && old_wd != wd) inotify_rm_watch(ifd_, old_wd);
+        bool covered = wd >= 0;
+        if (by_name_) {
+            string dir = fs::path(path).parent_path().string();
+            if (dir.empty()) dir = ".";
+            covered |= inotify_add_watch(ifd_, dir.c_str(), IN_CREATE | IN_MOVED_TO) >= 0;
+        }
+        covered_[path] = covered;
+        return wd;
+#else
+        return -1;
+#endif
+    }
 
-        file.seekg(0, ios::end);
-        std::streamoff pos_off = file.tellg();
-        if (pos_off < 0) pos_off = 0;
+    bool wait() {
+#ifdef __linux__
+        if (ifd_ >= 0) {
+            struct pollfd p{ifd_, POLLIN, 0};
+            bool all = true;
+            for (auto &c : covered_) all &= c.second;
+            while (!follow_interrupted) {
+                int r = poll(&p, 1, all ? -1 : 200);
+                if (r < 0 && errno != EINTR) break;   // fall back to polling
+                if (r == 0) return true;
+                if (r > 0) {
+                    alignas(struct inotify_event) char evbuf[4096];
+                    while (::read(ifd_, evbuf, sizeof(evbuf)) > 0) {}
+                    return true;
+                }
+            }
+            if (follow_interrupted) return false;
+            ::close(ifd_); ifd_ = -1;
+        }
+#endif
+        this_thread::sleep_for(chrono::milliseconds(200));
+        return !follow_interrupted;
+    }
 
-        std::streamoff start_off = 0;
-        if (pos_off > static_cast<std::streamoff>(4096)) start_off = pos_off - static_cast<std::streamoff>(4096);
-        file.clear();
-        file.seekg(start_off, ios::beg);
+private:
+    bool by_name_;
+#ifdef __linux__
+    int ifd_ = -1;
+    unordered_map<string, bool> covered_;   // path -> has a watch that wakes us
+#endif
+};
 
-        string line;
-        while (getline(file, line)) cout << line << '\n';
+// Follows several files from one event loop. With more than one file each
+// line is prefixed with its file name, so an unterminated tail is held back
+// until its newline arrives; a single file is passed through byte for byte.
+// A file that shrinks was truncated in place and is re-read from 0. With
+// by_name (-F) the path is re-checked on every wakeup: when its inode changes
+// the old descriptor is drained and the new file is opened from the start,
+// and paths that do not exist yet are retried.
+class TailFollow {
+public:
+    TailFollow(const vector<string> &paths, bool by_name) : by_name_(by_name), prefix_(paths.size() > 1), waiter_(by_name) {
+        files_.reserve(paths.size());
+        for (auto &p : paths) { files_.emplace_back(); files_.back().path = p; }
+    }
 
-        while (true) {
-            if (!getline(file, line)) {
-                this_thread::sleep_for(chrono::milliseconds(200));
-                file.clear();
-            } else {
-                cout << line << '\n';
+    void run(uintmax_t count, bool bytes) {
+        SigintScope sigint;
+        size_t live = 0;
+        for (auto &ff : files_) {
+            ff.wd = waiter_.watch(ff.path);
+            if (open(ff)) {
+                ff.f.seekg(0, ios::end);
+                streamoff size = ff.f.tellg();
+                ff.offset = size > 0 ? tail_offset(ff.f, static_cast<uintmax_t>(size), count, bytes) : 0;
+                ++live;
+            } else notice(ff, by_name_ ? "cannot open, will retry" : "cannot open");
+        }
+        if (!live && !by_name_) return;
+        do {
+            for (auto &ff : files_) check(ff);
+            out.flush();
+        } while (waiter_.wait());
+        out << '\n';
+    }
+
+private:
+    struct File {
+        string path;
+        ifstream f;
+        uintmax_t offset = 0;
+        uint64_t dev = 0, ino = 0;
+        string partial;
+        bool gone = false;   // path vanished; still reading the old descriptor
+        int wd = -1;         // inotify watch on the file
+    };
+
+    static bool identity(const string &path, uint64_t &dev, uint64_t &ino) {
+#ifdef _WIN32
+        error_code ec; dev = ino = 0;
+        return fs::is_regular_file(path, ec);
+#else
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0) return false;
+        dev = static_cast<uint64_t>(st.st_dev); ino = static_cast<uint64_t>(st.st_ino);
+        return true;
+#endif
+    }
+
+    bool open(File &ff) {
+        if (!identity(ff.path, ff.dev, ff.ino)) return false;
+        ff.f.open(ff.path, ios::binary);
+        ff.offset = 0;
+        return ff.f.is_open();
+    }
+
+    void notice(const File &ff, const char *what) {
+        out.flush();
+        eprint_colored(MTColor::YELLOW, "tail: " + ff.path + ": " + what + "\n");
+    }
+
+    void emit(File &ff, const char *p, size_t n) {
+        if (!prefix_) { out.write(p, n); return; }
+        while (n) {
+            const char *nl = static_cast<const char*>(memchr(p, '\n', n));
+            if (!nl) { ff.partial.append(p, n); return; }
+            size_t len = static_cast<size_t>(nl - p) + 1;
+            out.colored(MTColor::CYAN, ff.path) << ": " << ff.partial << string_view(p, len);
+            ff.partial.clear();
+            p += len; n -= len;
+        }
+    }
+
+    void end_partial(File &ff) {
+        if (!ff.partial.empty()) { ff.partial += '\n'; string rest; rest.swap(ff.partial); emit(ff, rest.data(), rest.size()); }
+    }
+
+    // Emits everything between the saved offset and the current end.
+    void drain(File &ff) {
+        ff.f.clear();
+        ff.f.seekg(static_cast<streamoff>(ff.offset));
+        while (ff.f.read(buf_.get(), 1 << 16) || ff.f.gcount() > 0) {
+            emit(ff, buf_.get(), static_cast<size_t>(ff.f.gcount()));
+            ff.offset += static_cast<uintmax_t>(ff.f.gcount());
+        }
+    }
+
+    void check(File &ff) {
+        if (ff.f.is_open()) {
+            ff.f.clear();
+            ff.f.seekg(0, ios::end);
+            streamoff size = ff.f.tellg();
+            if (size >= 0 && static_cast<uintmax_t>(size) < ff.offset) {
+                notice(ff, "file truncated");
+                ff.offset = 0; ff.partial.clear();
             }
+            drain(ff);
+            if (!by_name_) return;
+            uint64_t dev, ino;
+            bool exists = identity(ff.path, dev, ino);
+            if (exists && dev == ff.dev && ino == ff.ino) return;
+            if (!exists) {
+                // keep reading the old descriptor until a replacement shows up
+                if (!ff.gone) notice(ff, "file moved away, waiting for a new one");
+                ff.gone = true;
+                return;
+            }
+            // replaced: the old descriptor was fully drained above
+            end_partial(ff);
+            ff.f.close();
         }
-    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("tail -f: ") + ex.what() + "\n"); }
+        if (!open(ff)) return;
+        ff.gone = false;
+        notice(ff, "following new file");
+        ff.wd = waiter_.watch(ff.path, ff.wd);
+        drain(ff);
+    }
+
+    vector<File> files_;     // File holds an ifstream; never copied after setup
+    bool by_name_, prefix_;
+    ChangeWaiter waiter_;
+    unique_ptr<char[]> buf_{new char[1 << 16]};
+};
+
+// Prints the last `count` lines (or bytes) of one file.
+static void tail_file(const string &file, uintmax_t count, bool bytes) {
+    auto fail = [&file](int err) { out.flush(); eprint_colored(MTColor::RED, "tail: " + file + ": " + strerror(err) + "\n"); };
+    error_code ec;
+    if (fs::is_directory(file, ec)) { fail(EISDIR); return; }
+    ifstream f(file, ios::binary); if (!f) { fail(errno); return; }
+    f.seekg(0, ios::end);
+    streamoff size = f.tellg();
+    if (size < 0) {
+        // not seekable (a FIFO, say): keep a ring of the last lines
+        LineReader r(file); if (!r.ok()) { fail(r.error()); return; }
+        if (bytes) { eprint_colored(MTColor::RED, "tail: -c needs a seekable file\n"); return; }
+        deque<string> ring; string_view line;
+        while (r.next(line)) { if (count == 0) continue; if (ring.size() == count) ring.pop_front(); ring.emplace_back(line); }
+        if (r.error()) { fail(r.error()); return; }
+        for (auto &l : ring) out << l << '\n';
+        return;
+    }
+    f.clear();
+    f.seekg(static_cast<streamoff>(tail_offset(f, static_cast<uintmax_t>(size), count, bytes)));
+    char buf[1 << 14];
+    while (f.read(buf, sizeof(buf)) || f.gcount() > 0) out.write(buf, static_cast<size_t>(f.gcount()));
+    if (f.bad()) fail(EIO);
+}
+
+static void cmd_tail(const vector<string>& a) {
+    uintmax_t count = 10; bool bytes = false, follow = false, by_name = false;
+    vector<string> files;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "-f") follow = true;
+        else if (a[i] == "-F") follow = by_name = true;
+        else if (a[i].size() >= 2 && a[i][0] == '-' && (a[i][1] == 'n' || a[i][1] == 'c')) {
+            bytes = a[i][1] == 'c';
+            string_view num = a[i].size() > 2 ? string_view(a[i]).substr(2) : (i + 1 < a.size() ? string_view(a[++i]) : string_view());
+            if (num.empty() || from_chars(num.data(), num.data() + num.size(), count).ptr != num.data() + num.size()) {
+                eprint_colored(MTColor::YELLOW, "tail: bad count\n"); return;
+            }
+        } else files.push_back(a[i]);
+    }
+    if (files.empty()) { eprint_colored(MTColor::YELLOW, "tail: missing file\n"); return; }
+    if (follow) { TailFollow(files, by_name).run(count, bytes); return; }
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files.size() > 1) out << (i ? "\n" : "") << "==> " << files[i] << " <==\n";
+        tail_file(files[i], count, bytes);
+    }
 }
 
 static void cmd_chmod(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "chmod: usage chmod <octal> <file>\n"); return; }
     string s = a[1];
     if (!s.empty() && s[0] == '0') s = s.substr(1);
     if (s.size() < 3) s = string(3 - s.size(), '0') + s;
@@ -465,33 +3217,744 @@ static void cmd_chmod(const vector<string>& a) {
 }
 
 static void cmd_ln(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "ln: usage ln <target> <link>\n"); return; }
     try { fs::create_symlink(a[1], a[2]); cout << "symlink created\n"; }
     catch (const exception &ex) { eprint_colored(MTColor::RED, string("ln: ") + ex.what() + '\n'); }
 }
 
+// -- du --------------------------------------------------------------------
+// One node per directory, created by the parent's walk task (which is the only
+// writer of its `kids`), so creation order is a topological order and totals
+// can be rolled up afterwards in reverse without locking. Usage is kept in
+// both units so one walk (or one cache) serves du and du --apparent. A file
+// with several links is charged once, to the first directory in listing
+// order, so the breakdown does not depend on which thread got there first.
+struct DuLinked { uint64_t dev, ino, blocks, size; };
+
+struct DuNode {
+    string path, rel;                        // rel: relative to the root, "" for the root
+    DuNode *parent = nullptr;
+    uint32_t index = 0;                      // position in creation order
+    size_t rank = 0;                         // position in the (sorted) listing order
+    int depth = 0;
+    bool ok = false;                         // identity known and listing complete: cacheable
+    uint64_t dev = 0, ino = 0;
+    int64_t mtime = 0, ctime = 0;
+    uintmax_t self_blocks = 0, self_size = 0;     // the directory inode itself
+    uintmax_t files_blocks = 0, files_size = 0;   // its singly linked non-directories
+    uintmax_t linked_blocks = 0, linked_size = 0; // its multiply linked ones it was charged for
+    vector<DuLinked> linked;                 // all of them, charged after the walk
+    uintmax_t total = 0;
+    vector<DuNode*> kids;
+};
+
+// du --cache: one file per root directory under ~/.cache/cterminal, mapped
+// read-only. Per directory it holds the identity and mtime/ctime seen last
+// time and what the directory itself contributed (its inode, its files, its
+// hard-linked files by inode), plus its subdirectories. A directory whose
+// identity and times are unchanged is not read or stat'ed again; only its
+// subdirectories are opened to check theirs.
+// Limitation: rewriting a file in place (a growing log) changes its size
+// without touching its directory's times, so the new size is only picked up
+// once an entry in that directory is created, removed or renamed. The same
+// holds for a new hard link made elsewhere to a file in an unchanged
+// directory: the cached directory still counts it as singly linked.
+//
+// Layout: Header, Dir[ndirs], uint32 slots[nslots] (open addressing on the
+// hash of `rel`, entry index + 1, 0 = empty), uint32 kids[nkids] padded to 8,
+// DuLinked[nlinked], then the names blob.
+class DuCache {
+public:
+    struct Dir {
+        uint64_t dev, ino;
+        int64_t mtime, ctime;
+        uint64_t self_blocks, self_size, files_blocks, files_size;
+        uint64_t name_off, kids_off, linked_off;
+        uint32_t name_len, nkids, nlinked, ok;
+    };
+
+    DuCache() = default;
+    DuCache(const DuCache&) = delete;
+    DuCache &operator=(const DuCache&) = delete;
+    ~DuCache() {
+#ifndef _WIN32
+        if (map_) munmap(const_cast<char*>(map_), map_size_);
+#endif
+    }
+
+    static string file_for(const string &root) {
+        error_code ec;
+        fs::path abs = fs::weakly_canonical(fs::absolute(root, ec), ec);
+        string key = abs.string();
+        char hex[17];
+        snprintf(hex, sizeof hex, "%016llx", static_cast<unsigned long long>(hash_bytes(key.data(), key.size())));
+#ifdef _WIN32
+        const char *base = getenv("LOCALAPPDATA");
+        fs::path dir = fs::path(base ? base : ".") / "cterminal";
+#else
+        const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+        fs::path dir = (xdg && *xdg) ? fs::path(xdg) / "cterminal" : fs::path(home ? home : "/tmp") / ".cache" / "cterminal";
+#endif
+        return (dir / ("du-" + string(hex) + ".bin")).string();
+    }
+
+    // Maps `file`; a missing, foreign or damaged file just leaves the cache empty.
+    bool load(const string &file) {
+#ifndef _WIN32
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) { close(fd); return false; }
+        void *m = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) return false;
+        map_ = static_cast<const char*>(m); map_size_ = static_cast<size_t>(st.st_size);
+#else
+        ifstream f(file, ios::binary);
+        if (!f) return false;
+        buf_.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        if (buf_.size() < sizeof(Header)) return false;
+        map_ = buf_.data(); map_size_ = buf_.size();
+#endif
+        Header h; memcpy(&h, map_, sizeof h);
+        if (memcmp(h.magic, MAGIC, sizeof h.magic) != 0 || (h.nslots & (h.nslots - 1)) || h.nslots <= h.ndirs) return fail();
+        Layout l(h, map_size_);
+        if (!l.ok || l.end != map_size_) return fail();
+        dirs_ = reinterpret_cast<const Dir*>(map_ + l.dirs);
+        slots_ = reinterpret_cast<const uint32_t*>(map_ + l.slots);
+        kids_ = reinterpret_cast<const uint32_t*>(map_ + l.kids);
+        linked_ = reinterpret_cast<const DuLinked*>(map_ + l.linked);
+        names_ = map_ + l.names;
+        h_ = h;
+        for (uint64_t i = 0; i < h.ndirs; ++i) {
+            const Dir &d = dirs_[i];
+            if (d.name_len > h.names_size || d.name_off > h.names_size - d.name_len ||
+                d.nkids > h.nkids || d.kids_off > h.nkids - d.nkids ||
+                d.nlinked > h.nlinked || d.linked_off > h.nlinked - d.nlinked) return fail();
+        }
+        for (uint64_t i = 0; i < h.nkids; ++i) if (kids_[i] >= h.ndirs) return fail();
+        // slot values index dirs_; at most ndirs may be used so every probe chain ends
+        uint64_t used = 0;
+        for (uint64_t i = 0; i < h.nslots; ++i) {
+            if (slots_[i] > h.ndirs) return fail();
+            used += slots_[i] != 0;
+        }
+        if (used > h.ndirs) return fail();
+        return true;
+    }
+
+    const Dir *find(string_view rel) const {
+        if (!h_.nslots) return nullptr;
+        for (uint64_t i = hash_bytes(rel.data(), rel.size()) & (h_.nslots - 1); slots_[i]; i = (i + 1) & (h_.nslots - 1)) {
+            const Dir &d = dirs_[slots_[i] - 1];
+            if (name(d) == rel) return &d;
+        }
+        return nullptr;
+    }
+    string_view name(const Dir &d) const { return string_view(names_ + d.name_off, d.name_len); }
+    const Dir &kid(const Dir &d, uint32_t i) const { return dirs_[kids_[d.kids_off + i]]; }
+    const DuLinked *linked(const Dir &d) const { return linked_ + d.linked_off; }
+
+    // Writes `nodes` (indexed by DuNode::index) to a temp file and renames it
+    // over `file`, so a concurrent du never maps a half-written cache.
+    static bool save(const string &file, const deque<DuNode> &nodes) {
+        Header h{};
+        memcpy(h.magic, MAGIC, sizeof h.magic);
+        h.ndirs = nodes.size();
+        h.nslots = 16;
+        while (h.nslots < h.ndirs * 2) h.nslots *= 2;
+        vector<Dir> dirs; dirs.reserve(nodes.size());
+        vector<uint32_t> slots(h.nslots), kids;
+        vector<DuLinked> linked;
+        string names;
+        for (const DuNode &n : nodes) {
+            Dir d{};
+            d.dev = n.dev; d.ino = n.ino; d.mtime = n.mtime; d.ctime = n.ctime;
+            d.self_blocks = n.self_blocks; d.self_size = n.self_size; d.files_blocks = n.files_blocks; d.files_size = n.files_size;
+            d.name_off = names.size(); d.name_len = static_cast<uint32_t>(n.rel.size()); names += n.rel;
+            d.kids_off = kids.size(); d.nkids = static_cast<uint32_t>(n.kids.size());
+            for (const DuNode *k : n.kids) kids.push_back(k->index);
+            d.linked_off = linked.size(); d.nlinked = static_cast<uint32_t>(n.linked.size());
+            linked.insert(linked.end(), n.linked.begin(), n.linked.end());
+            d.ok = n.ok;
+            uint64_t i = hash_bytes(n.rel.data(), n.rel.size()) & (h.nslots - 1);
+            while (slots[i]) i = (i + 1) & (h.nslots - 1);
+            slots[i] = static_cast<uint32_t>(dirs.size() + 1);
+            dirs.push_back(d);
+        }
+        h.nkids = kids.size(); h.nlinked = linked.size(); h.names_size = names.size();
+        Layout l(h);
+        string img(l.end, '\0');
+        memcpy(&img[0], &h, sizeof h);
+        if (!dirs.empty()) memcpy(&img[l.dirs], dirs.data(), dirs.size() * sizeof(Dir));
+        memcpy(&img[l.slots], slots.data(), slots.size() * sizeof(uint32_t));
+        if (!kids.empty()) memcpy(&img[l.kids], kids.data(), kids.size() * sizeof(uint32_t));
+        if (!linked.empty()) memcpy(&img[l.linked], linked.data(), linked.size() * sizeof(DuLinked));
+        if (!names.empty()) memcpy(&img[l.names], names.data(), names.size());
+
+        error_code ec;
+        fs::create_directories(fs::path(file).parent_path(), ec);
+        string tmp = file + ".tmp" + to_string(hash_bytes(file.data(), file.size()) ^ static_cast<uint64_t>(time(nullptr)));
+        {
+            ofstream f(tmp, ios::binary | ios::trunc);
+            if (!f.write(img.data(), static_cast<streamsize>(img.size())) || !f.flush()) { fs::remove(tmp, ec); return false; }
+        }
+        fs::rename(tmp, file, ec);
+        if (ec) fs::remove(tmp, ec);
+        return !ec;
+    }
+
+private:
+    static constexpr char MAGIC[8] = { 'C', 'T', 'D', 'U', 'C', '0', '0', '1' };
+    struct Header { char magic[8]; uint64_t ndirs, nslots, nkids, nlinked, names_size; };
+    struct Layout {
+        uint64_t dirs, slots, kids, linked, names, end;
+        bool ok = true;
+        // Every step is checked against `limit`, so counts read from a damaged
+        // file cannot wrap around; ok is false if the layout does not fit.
+        explicit Layout(const Header &h, uint64_t limit = UINT64_MAX) {
+            auto span = [&](uint64_t at, uint64_t n, uint64_t size) {
+                if (!ok || at > limit || n > (limit - at) / size) { ok = false; return limit; }
+                return at + n * size;
+            };
+            dirs = sizeof(Header);
+            slots = span(dirs, h.ndirs, sizeof(Dir));
+            kids = span(slots, h.nslots, sizeof(uint32_t));
+            linked = span(kids, h.nkids, sizeof(uint32_t));
+            linked = span(linked, (8 - linked % 8) % 8, 1);
+            names = span(linked, h.nlinked, sizeof(DuLinked));
+            end = span(names, h.names_size, 1);
+        }
+    };
+
+    bool fail() { h_ = Header{}; return false; }
+
+    const char *map_ = nullptr;
+    size_t map_size_ = 0;
+#ifdef _WIN32
+    string buf_;
+#endif
+    Header h_{};
+    const Dir *dirs_ = nullptr;
+    const uint32_t *slots_ = nullptr, *kids_ = nullptr;
+    const DuLinked *linked_ = nullptr;
+    const char *names_ = nullptr;
+};
+
 static void cmd_du(const vector<string>& a) {
-    string p = "."; if (a.size() > 1) p = a[1];
-    try {
-        uintmax_t total = 0;
-        for (auto &e : fs::recursive_directory_iterator(p)) {
-            try { if (fs::is_regular_file(e)) total += fs::file_size(e); } catch(...){}
+    int max_depth = -1;
+    bool apparent = false, by_size = false, use_cache = false;
+    string p = ".";
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "-s") max_depth = 0;
+        else if (a[i] == "--apparent") apparent = true;
+        else if (a[i] == "--sort") by_size = true;
+        else if (a[i] == "--cache") use_cache = true;
+        else if (a[i] == "-d" && i + 1 < a.size()) {
+            const string &v = a[++i];
+            auto r = from_chars(v.data(), v.data() + v.size(), max_depth);
+            if (r.ec != errc() || r.ptr != v.data() + v.size() || max_depth < 0) { eprint_colored(MTColor::YELLOW, "du: bad depth\n"); return; }
+        }
+        else p = a[i];
+    }
+    FileMeta root;
+    if (!stat_path(p, root)) { eprint_colored(MTColor::RED, "du: " + p + ": " + strerror(errno) + '\n'); return; }
+    auto usage = [apparent](uintmax_t blocks, uintmax_t size) { return apparent ? size : blocks; };
+    auto kib = [](uintmax_t bytes) { return (bytes + 1023) / 1024; };
+    if (root.type != FileType::Dir) { out << kib(usage(root.blocks, root.size)) << "K\t" << p << '\n'; return; }
+
+    DuCache cache;
+    string cache_file;
+    if (use_cache) { cache_file = DuCache::file_for(p); cache.load(cache_file); }
+
+    deque<DuNode> nodes;              // stable addresses; appended under `nodes_m`
+    mutex nodes_m;
+    auto add_node = [&](DuNode &parent, string path, string rel) -> DuNode* {
+        lock_guard<mutex> lk(nodes_m);
+        nodes.emplace_back();
+        DuNode &k = nodes.back();
+        k.path = move(path); k.rel = move(rel);
+        k.parent = &parent; k.index = static_cast<uint32_t>(nodes.size() - 1); k.depth = parent.depth + 1;
+        parent.kids.push_back(&k);
+        return &k;
+    };
+    nodes.emplace_back();
+    nodes[0].path = p;
+
+    // every directory stats itself once it is open; with a cache hit its
+    // listing is replayed instead of read
+    auto prefill = [&](WalkDir &d) {
+        DuNode &n = *static_cast<DuNode*>(d.ctx);
+        FileMeta m;
+        if (!stat_dir(d, m)) return false;
+        n.dev = m.dev; n.ino = m.ino; n.mtime = m.mtime; n.ctime = m.ctime;
+        n.self_blocks = m.blocks; n.self_size = m.size;
+        n.ok = true;
+        const DuCache::Dir *c = use_cache ? cache.find(n.rel) : nullptr;
+        if (!c || !c->ok || c->dev != n.dev || c->ino != n.ino || c->mtime != n.mtime || c->ctime != n.ctime) return false;
+        n.files_blocks = c->files_blocks; n.files_size = c->files_size;
+        n.linked.assign(cache.linked(*c), cache.linked(*c) + c->nlinked);
+        for (uint32_t i = 0; i < c->nkids; ++i) {
+            string_view rel = cache.name(cache.kid(*c, i));
+            DirEntry e;
+            e.name = string(rel.substr(rel.rfind('/') + 1));   // npos + 1 == 0 for top-level names
+            e.type = FileType::Dir; e.descend = true;
+            e.ctx = add_node(n, d.child(e), string(rel));
+            d.entries.push_back(move(e));
+        }
+        return true;
+    };
+    auto visit = [&](WalkDir &d) {
+        DuNode &n = *static_cast<DuNode*>(d.ctx);
+        if (d.partial) n.ok = false;
+        FileMeta m;
+        for (auto &e : d.entries) {
+            if (e.type == FileType::Dir) {
+                e.ctx = add_node(n, d.child(e), n.rel.empty() ? e.name : n.rel + '/' + e.name);
+                continue;
+            }
+            if (!stat_entry(d, e, m)) { n.ok = false; continue; }
+            if (m.nlink > 1) n.linked.push_back(DuLinked{ m.dev, m.ino, m.blocks, m.size });
+            else { n.files_blocks += m.blocks; n.files_size += m.size; }
+        }
+    };
+    WalkOptions opt; opt.who = "du";
+    walk_tree(p, opt, visit, &nodes[0], prefill);
+
+    // listing order: post-order, children before their parent, siblings by name
+    vector<DuNode*> order;
+    size_t visited = 0;
+    function<void(DuNode&)> collect = [&](DuNode &n) {
+        n.rank = visited++;                     // reached first = charged for shared inodes
+        sort(n.kids.begin(), n.kids.end(), [](const DuNode *x, const DuNode *y) { return x->path < y->path; });
+        for (DuNode *k : n.kids) collect(*k);
+        order.push_back(&n);
+    };
+    collect(nodes[0]);
+    struct InoKey { uint64_t dev, ino; bool operator==(const InoKey &o) const { return dev == o.dev && ino == o.ino; } };
+    struct InoHash { size_t operator()(const InoKey &k) const { return static_cast<size_t>(k.ino * 0x9E3779B97F4A7C15ull ^ k.dev); } };
+    unordered_map<InoKey, pair<DuNode*, const DuLinked*>, InoHash> owner;
+    for (DuNode &n : nodes)
+        for (const DuLinked &l : n.linked) {
+            auto r = owner.emplace(InoKey{ l.dev, l.ino }, make_pair(&n, &l));
+            if (!r.second && n.rank < r.first->second.first->rank) r.first->second = make_pair(&n, &l);
+        }
+    for (auto &o : owner) { o.second.first->linked_blocks += o.second.second->blocks; o.second.first->linked_size += o.second.second->size; }
+
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+        it->total += usage(it->self_blocks + it->files_blocks + it->linked_blocks, it->self_size + it->files_size + it->linked_size);
+        if (it->parent) it->parent->total += it->total;
+    }
+    if (use_cache && !DuCache::save(cache_file, nodes))
+        eprint_colored(MTColor::YELLOW, "du: could not write cache " + cache_file + '\n');
+
+    vector<const DuNode*> shown;
+    for (const DuNode *n : order) if (max_depth < 0 || n->depth <= max_depth) shown.push_back(n);
+    if (by_size) stable_sort(shown.begin(), shown.end(), [](const DuNode *x, const DuNode *y) { return x->total > y->total; });
+    for (const DuNode *n : shown) out << kib(n->total) << "K\t" << n->path << '\n';
+}
+
+// -- sort ------------------------------------------------------------------
+// Key selection and ordering, fixed when the command line is parsed.
+struct SortSpec {
+    size_t key_first = 0, key_last = 0;   // 1-based fields (-k F[,L]); 0 = whole line / to end
+    char sep = 0;                         // -t; 0 = blank-to-nonblank transitions, like POSIX sort
+    bool numeric = false, reverse = false, unique = false;
+    bool reverse_line = false;            // global -r also flips the whole-line tie-break; -k2r does not
+
+    // A line with its key located and pre-digested: numeric keys are parsed
+    // once, text keys get their first 8 bytes packed big-endian so most
+    // comparisons are one integer compare.
+    struct Keyed { string_view line, key; double num = 0; uint64_t prefix = 0; };
+
+    // Offset of field f (1-based) and of the end of field f within l.
+    size_t field_begin(string_view l, size_t f) const {
+        size_t i = 0;
+        for (; f > 1 && i < l.size(); --f) i = field_end_at(l, i) + (sep ? 1 : 0);
+        return min(i, l.size());
+    }
+    size_t field_end_at(string_view l, size_t i) const {
+        if (sep) { size_t p = l.find(sep, i); return p == string_view::npos ? l.size() : p; }
+        while (i < l.size() && (l[i] == ' ' || l[i] == '\t')) ++i;
+        while (i < l.size() && l[i] != ' ' && l[i] != '\t') ++i;
+        return i;
+    }
+
+    Keyed keyed(string_view line) const {
+        Keyed k; k.line = line; k.key = line;
+        if (key_first) {
+            size_t beg = field_begin(line, key_first);
+            size_t end = key_last ? field_end_at(line, field_begin(line, key_last)) : line.size();
+            k.key = line.substr(beg, end > beg ? end - beg : 0);
+        }
+        if (numeric) {
+            string_view t = k.key;
+            while (!t.empty() && (t[0] == ' ' || t[0] == '\t')) t.remove_prefix(1);
+            if (from_chars(t.data(), t.data() + t.size(), k.num).ec != errc()) k.num = 0;
+        } else {
+            for (size_t i = 0; i < 8; ++i)
+                k.prefix = (k.prefix << 8) | (i < k.key.size() ? static_cast<unsigned char>(k.key[i]) : 0u);
+        }
+        return k;
+    }
+
+    // <0, 0, >0. Ties on the key fall back to the whole line (unless -u,
+    // where key-equal lines are duplicates).
+    int compare(const Keyed &x, const Keyed &y) const {
+        int c = 0;
+        if (numeric) c = x.num < y.num ? -1 : (y.num < x.num ? 1 : 0);
+        else if (x.prefix != y.prefix) c = x.prefix < y.prefix ? -1 : 1;
+        else c = x.key.compare(y.key);
+        if (c != 0) return reverse ? -c : c;
+        if (unique) return 0;
+        c = x.line.compare(y.line);
+        return reverse_line ? -c : c;
+    }
+};
+
+// External merge sort. A run lives in one block of exactly the memory budget
+// (-S): line bytes are packed from the front, fixed-size records from the
+// back, and when the two would meet the run is sorted and spilled to a temp
+// file. Pages of the block are only touched as they fill, so small inputs
+// stay small. At the end the runs are k-way merged through a loser tree, each
+// read back through its own LineReader. Input that fits the budget never
+// touches disk. Runs are sorted in place and in parallel: one slice per core,
+// each std::sort'ed with the input position as the final tie-break (so the
+// order is that of a stable sort), then the slices are merged on the fly as
+// the run is written out. Nothing beyond the block is allocated per record.
+class ExternalSorter {
+public:
+    ExternalSorter(uintmax_t budget, const SortSpec &spec) : budget_(max<uintmax_t>(budget, 1 << 16)), spec_(spec) {}
+    ~ExternalSorter() { error_code ec; for (auto &p : runs_) fs::remove(p, ec); }
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter &operator=(const ExternalSorter&) = delete;
+
+    void add(string_view line) {
+        if (!mem_ || static_cast<size_t>(reinterpret_cast<char*>(recs_) - mem_.get()) < used_ + line.size() + sizeof(Rec)) {
+            if (nrecs_) spill();
+            // a single line larger than the whole budget gets a block of its own
+            size_t want = max<size_t>(static_cast<size_t>(budget_), line.size() + 2 * sizeof(Rec));
+            if (!mem_ || cap_ != want / alignof(Rec) * alignof(Rec)) alloc(want);
+        }
+        memcpy(mem_.get() + used_, line.data(), line.size());
+        SortSpec::Keyed k = spec_.keyed(string_view(mem_.get() + used_, line.size()));
+        Rec r;
+        r.off = used_; r.len = static_cast<uint32_t>(line.size());
+        r.key_off = static_cast<uint32_t>(k.key.data() - k.line.data()); r.key_len = static_cast<uint32_t>(k.key.size());
+        r.num = k.num; r.prefix = k.prefix;
+        *--recs_ = r;
+        ++nrecs_;
+        used_ += line.size();
+    }
+
+    template <typename Emit>
+    void finish(Emit &&emit) {
+        if (runs_.empty()) {
+            sort_run();
+            const Rec *prev = nullptr;
+            each_sorted([&](const Rec &r) {
+                if (spec_.unique && prev && cmp(*prev, r) == 0) return;
+                emit(line(r)); prev = &r;
+            });
+            return;
+        }
+        if (nrecs_) spill();
+        mem_.reset();
+        merge(emit);
+    }
+
+private:
+    struct Rec { size_t off; uint32_t len, key_off, key_len; double num; uint64_t prefix; };
+
+    void alloc(size_t bytes) {
+        cap_ = bytes / alignof(Rec) * alignof(Rec);
+        mem_.reset();
+        mem_.reset(new char[cap_]);
+        recs_ = reinterpret_cast<Rec*>(mem_.get() + cap_);
+        nrecs_ = 0; used_ = 0;
+    }
+
+    string_view line(const Rec &r) const { return string_view(mem_.get() + r.off, r.len); }
+    SortSpec::Keyed keyed(const Rec &r) const {
+        SortSpec::Keyed k;
+        k.line = line(r); k.key = k.line.substr(r.key_off, r.key_len); k.num = r.num; k.prefix = r.prefix;
+        return k;
+    }
+    int cmp(const Rec &x, const Rec &y) const { return spec_.compare(keyed(x), keyed(y)); }
+    bool before(const Rec &x, const Rec &y) const { int c = cmp(x, y); return c < 0 || (c == 0 && x.off < y.off); }
+
+    void sort_run() {
+        auto less = [this](const Rec &x, const Rec &y) { return before(x, y); };
+        const size_t n = nrecs_;
+        const size_t parts = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), n / 65536));
+        cut_.assign(parts + 1, 0);
+        for (size_t i = 0; i <= parts; ++i) cut_[i] = n * i / parts;
+        if (parts == 1) { sort(recs_, recs_ + n, less); return; }
+        WorkPool pool(static_cast<unsigned>(parts));
+        for (size_t i = 0; i < parts; ++i) pool.submit([&, i] { sort(recs_ + cut_[i], recs_ + cut_[i + 1], less); });
+        pool.wait();
+    }
+
+    // Visits the sorted run: a heap over the slice heads merges them in place.
+    template <typename Fn>
+    void each_sorted(Fn &&fn) const {
+        const size_t parts = cut_.size() - 1;
+        if (parts == 1) { for (size_t i = 0; i < nrecs_; ++i) fn(recs_[i]); return; }
+        vector<size_t> pos(cut_.begin(), cut_.end() - 1), heap;
+        auto later = [&](size_t x, size_t y) { return before(recs_[pos[y]], recs_[pos[x]]); };
+        for (size_t i = 0; i < parts; ++i) if (pos[i] < cut_[i + 1]) heap.push_back(i);
+        make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), later);
+            size_t i = heap.back();
+            fn(recs_[pos[i]++]);
+            if (pos[i] < cut_[i + 1]) push_heap(heap.begin(), heap.end(), later);
+            else heap.pop_back();
         }
-        cout << (total / 1024) << "K\t" << p << '\n';
-    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("du: ") + ex.what() + '\n'); }
+    }
+
+    void spill() {
+        sort_run();
+        static atomic<unsigned> seq{0};
+#ifdef _WIN32
+        auto pid = GetCurrentProcessId();
+#else
+        auto pid = getpid();
+#endif
+        fs::path p = fs::temp_directory_path() / ("ctsort-" + to_string(pid) + "-" + to_string(seq++) + ".run");
+        ofstream f(p, ios::binary | ios::trunc);
+        if (!f) throw runtime_error("cannot create temp file " + p.string());
+        runs_.push_back(p.string());
+        // the write buffer is small next to the budget; the stream adds its own few KB
+        const size_t flush_at = static_cast<size_t>(min<uintmax_t>(1 << 20, budget_ / 64));
+        string buf;
+        buf.reserve(flush_at + 4096);
+        const Rec *prev = nullptr;
+        each_sorted([&](const Rec &r) {
+            if (spec_.unique && prev && cmp(*prev, r) == 0) return;
+            prev = &r;
+            buf.append(line(r)) += '\n';
+            if (buf.size() >= flush_at) { f.write(buf.data(), static_cast<streamsize>(buf.size())); buf.clear(); }
+        });
+        f.write(buf.data(), static_cast<streamsize>(buf.size()));
+        if (!f.flush()) throw runtime_error("write to temp file failed (disk full?)");
+        recs_ = reinterpret_cast<Rec*>(mem_.get() + cap_);
+        nrecs_ = 0; used_ = 0;
+    }
+
+    // Loser tree over the runs: tree[0] holds the current winner, each inner
+    // node the loser of the match played there, so replacing the winner costs
+    // one compare per level (log k) instead of k.
+    template <typename Emit>
+    void merge(Emit &emit) {
+        const int k = static_cast<int>(runs_.size());
+        const size_t block = static_cast<size_t>(min<uintmax_t>(1 << 20, max<uintmax_t>(1 << 16, budget_ / (runs_.size() + 1))));
+        vector<unique_ptr<LineReader>> src;
+        vector<SortSpec::Keyed> head(runs_.size());
+        vector<char> live(runs_.size());
+        auto advance = [&](int i) {
+            string_view l;
+            live[i] = src[i]->next(l);
+            if (live[i]) head[i] = spec_.keyed(l);
+            else if (src[i]->error()) throw runtime_error("reading temp file " + runs_[i] + ": " + strerror(src[i]->error()));
+        };
+        for (int i = 0; i < k; ++i) {
+            src.emplace_back(new LineReader(runs_[i], block));
+            if (!src[i]->ok()) throw runtime_error("cannot reopen temp file " + runs_[i]);
+            advance(i);
+        }
+        // leaf k is a sentinel that beats everything; it only exists while building
+        auto beats = [&](int x, int y) {
+            if (x == k) return true;
+            if (y == k) return false;
+            if (!live[x]) return false;
+            if (!live[y]) return true;
+            int c = spec_.compare(head[x], head[y]);
+            return c < 0 || (c == 0 && x < y);
+        };
+        vector<int> tree(k, k);
+        auto replay = [&](int s) {
+            for (int t = (s + k) >> 1; t > 0; t >>= 1)
+                if (beats(tree[t], s)) swap(s, tree[t]);
+            tree[0] = s;
+        };
+        for (int i = k - 1; i >= 0; --i) replay(i);
+        string last;
+        bool have_last = false;
+        while (live[tree[0]]) {
+            int w = tree[0];
+            if (!spec_.unique || !have_last || spec_.compare(spec_.keyed(last), head[w]) != 0) {
+                emit(head[w].line);
+                if (spec_.unique) { last.assign(head[w].line); have_last = true; }
+            }
+            advance(w);
+            replay(w);
+        }
+    }
+
+    uintmax_t budget_;
+    SortSpec spec_;
+    unique_ptr<char[]> mem_;            // the run: line bytes [0, used_), records [recs_, end)
+    size_t cap_ = 0, used_ = 0, nrecs_ = 0;
+    Rec *recs_ = nullptr;
+    vector<size_t> cut_;                // sorted slices of the records
+    vector<string> runs_;
+};
+
+// "2G", "512M", "64K" or plain bytes.
+static bool parse_size(string_view s, uintmax_t &v) {
+    auto r = from_chars(s.data(), s.data() + s.size(), v);
+    if (r.ptr == s.data()) return false;
+    string_view unit = s.substr(static_cast<size_t>(r.ptr - s.data()));
+    if (unit.empty() || unit == "b" || unit == "B") return true;
+    const char *units = "KMGT";
+    const char *u = strchr(units, toupper(static_cast<unsigned char>(unit[0])));
+    if (!u || unit.size() > 1) return false;
+    for (const char *p = units; p <= u; ++p) v <<= 10;
+    return true;
 }
 
 static void cmd_sort(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "sort: missing file\n"); return; }
-    ifstream f(a[1]); if (!f) { eprint_colored(MTColor::RED, "sort: cannot open file\n"); return; }
-    vector<string> lines; string line; while (getline(f, line)) lines.push_back(line);
-    sort(lines.begin(), lines.end()); for (auto &l : lines) cout << l << '\n';
+    uintmax_t budget = uintmax_t(1) << 30;
+    SortSpec spec;
+    string file;
+    bool key_mods = false, key_n = false, key_r = false;   // as POSIX: modifiers on -k override -n/-r for that key
+    auto bad = [](const char *what) { eprint_colored(MTColor::YELLOW, string("sort: ") + what + "\n"); };
+    for (size_t i = 1; i < a.size(); ++i) {
+        string o = a[i], v;
+        if (o.size() >= 2 && (o.compare(0, 2, "-S") == 0 || o.compare(0, 2, "-k") == 0 || o.compare(0, 2, "-t") == 0)) {
+            // value glued (-k2,2) or as the next argument (-k 2,2)
+            if (o.size() > 2) { v = o.substr(2); o.resize(2); }
+            else if (i + 1 < a.size()) v = a[++i];
+            else { bad("option needs a value"); return; }
+            if (o == "-S" && !parse_size(v, budget)) { bad("bad size for -S"); return; }
+            if (o == "-t") {
+                if (v.size() != 1) { bad("-t takes a single character"); return; }
+                spec.sep = v[0];
+            }
+            if (o == "-k") {
+                // F[,L] with optional trailing n/r, e.g. 2,2n
+                const char *p = v.data(), *e = v.data() + v.size();
+                auto r = from_chars(p, e, spec.key_first);
+                if (r.ptr == p || spec.key_first == 0) { bad("bad -k field"); return; }
+                p = r.ptr;
+                if (p < e && *p == ',') {
+                    r = from_chars(p + 1, e, spec.key_last);
+                    if (r.ptr == p + 1 || spec.key_last < spec.key_first) { bad("bad -k field"); return; }
+                    p = r.ptr;
+                }
+                for (; p < e; ++p) {
+                    if (*p == 'n') key_n = true;
+                    else if (*p == 'r') key_r = true;
+                    else { bad("bad -k field"); return; }
+                    key_mods = true;
+                }
+            }
+        } else if (o.size() > 1 && o[0] == '-' && o.find_first_not_of("nru", 1) == string::npos) {
+            spec.numeric |= o.find('n') != string::npos;
+            spec.reverse_line |= o.find('r') != string::npos;
+            spec.unique |= o.find('u') != string::npos;
+        } else file = o;
+    }
+    if (file.empty()) { bad("missing file"); return; }
+    spec.reverse = spec.reverse_line;
+    if (key_mods) { spec.numeric = key_n; spec.reverse = key_r; }
+    LineReader r(file);
+    try {
+        ExternalSorter sorter(budget, spec);
+        string_view line;
+        while (r.next(line)) sorter.add(line);
+        if (r.error()) { eprint_colored(MTColor::RED, "sort: " + file + ": " + strerror(r.error()) + "\n"); return; }
+        sorter.finish([](string_view l) { out << l << '\n'; });
+    } catch (const exception &ex) { out.flush(); eprint_colored(MTColor::RED, string("sort: ") + ex.what() + '\n'); }
 }
 
+// -- uniq ------------------------------------------------------------------
+// Distinct lines with occurrence counts, for uniq --all. Lines are copied once
+// into an arena; the open-addressing table stores the full hash next to the
+// entry index, so a probe only touches the arena when the hashes match.
+class LineCounter {
+public:
+    LineCounter() : slots_(1 << 12) {}
+
+    void add(string_view line) {
+        uint64_t h = hash_bytes(line.data(), line.size());
+        for (size_t i = h & (slots_.size() - 1);; i = (i + 1) & (slots_.size() - 1)) {
+            Slot &s = slots_[i];
+            if (s.idx == 0) {
+                entries_.push_back({ arena_.size(), line.size(), 1 });
+                arena_.append(line);
+                s.hash = h; s.idx = entries_.size();
+                if (entries_.size() * 10 > slots_.size() * 7) grow();
+                return;
+            }
+            if (s.hash == h && text(entries_[s.idx - 1]) == line) { ++entries_[s.idx - 1].count; return; }
+        }
+    }
+
+    // First-occurrence order, or most frequent first (ties keep input order).
+    template <typename Emit>
+    void each(bool by_count, Emit &&emit) const {
+        vector<uint32_t> order(entries_.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<uint32_t>(i);
+        if (by_count)
+            stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) { return entries_[x].count > entries_[y].count; });
+        for (uint32_t i : order) emit(text(entries_[i]), entries_[i].count);
+    }
+
+private:
+    struct Slot { uint64_t hash = 0; size_t idx = 0; };   // idx is entry + 1; 0 = empty
+    struct Entry { size_t off, len; uintmax_t count; };
+
+    string_view text(const Entry &e) const { return string_view(arena_.data() + e.off, e.len); }
+
+    void grow() {
+        vector<Slot> bigger(slots_.size() * 2);
+        for (auto &s : slots_) {
+            if (!s.idx) continue;
+            size_t i = s.hash & (bigger.size() - 1);
+            while (bigger[i].idx) i = (i + 1) & (bigger.size() - 1);
+            bigger[i] = s;
+        }
+        slots_.swap(bigger);
+    }
+
+    string arena_;
+    vector<Entry> entries_;
+    vector<Slot> slots_;
+};
+
 static void cmd_uniq(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "uniq: missing file\n"); return; }
-    ifstream f(a[1]); if (!f) { eprint_colored(MTColor::RED, "uniq: cannot open file\n"); return; }
-    string prev, cur; if (getline(f, prev)) cout << prev << '\n'; while (getline(f, cur)) { if (cur != prev) cout << cur << '\n'; prev = cur; }
+    bool count = false, all = false, by_count = false;
+    string file;
+    for (size_t i = 1; i < a.size(); ++i) {
+        if (a[i] == "-c") count = true;
+        else if (a[i] == "--all") all = true;
+        else if (a[i] == "--by-count") all = by_count = true;
+        else file = a[i];
+    }
+    if (file.empty()) { eprint_colored(MTColor::YELLOW, "uniq: missing file\n"); return; }
+    LineReader r(file);
+    auto fail = [&] { out.flush(); eprint_colored(MTColor::RED, "uniq: " + file + ": " + strerror(r.error()) + "\n"); };
+    auto emit = [count](string_view line, uintmax_t n) {
+        if (count) out.pad(n, 7) << ' ';
+        out << line << '\n';
+    };
+    string_view cur;
+    if (all) {
+        LineCounter lines;
+        while (r.next(cur)) lines.add(cur);
+        if (r.error()) { fail(); return; }
+        lines.each(by_count, emit);
+        return;
+    }
+    string prev; uintmax_t n = 0;
+    while (r.next(cur)) {
+        if (n && cur == prev) { ++n; continue; }
+        if (n) emit(prev, n);
+        prev.assign(cur); n = 1;
+    }
+    if (r.error()) { fail(); return; }
+    if (n) emit(prev, n);
 }
 
 static void cmd_history(const vector<string>& a) {
@@ -502,7 +3965,6 @@ static void cmd_history(const vector<string>& a) {
 // -- EXTRA commands --------------------------------------------------------
 
 static void cmd_which(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "which: missing argument\n"); return; }
     string cmd = a[1];
 #ifdef _WIN32
     const char sep = ';';
@@ -528,7 +3990,6 @@ static void cmd_which(const vector<string>& a) {
 }
 
 static void cmd_open(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "open: missing file\n"); return; }
     string file = a[1];
 #ifdef _WIN32
     string cmd = "start \"\" \"" + file + "\"";
@@ -561,16 +4022,15 @@ static void cmd_env(const vector<string>& a) {
 }
 
 static void cmd_setenv(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "setenv: usage setenv NAME VALUE\n"); return; }
 #ifdef _WIN32
     if (!SetEnvironmentVariableA(a[1].c_str(), a[2].c_str())) eprint_colored(MTColor::RED, "setenv: failed\n");
 #else
     if (setenv(a[1].c_str(), a[2].c_str(), 1) != 0) eprint_colored(MTColor::RED, "setenv: failed\n");
 #endif
+    invalidate_prompt();
 }
 
 static void cmd_stat(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "stat: missing file\n"); return; }
     fs::path p(a[1]);
     if (!fs::exists(p)) { eprint_colored(MTColor::YELLOW, "stat: not found\n"); return; }
     try {
@@ -585,17 +4045,19 @@ static void cmd_stat(const vector<string>& a) {
 static void cmd_count(const vector<string>& a) {
     string p = ".";
     if (a.size() > 1) p = a[1];
-    try {
-        size_t files = 0, dirs = 0;
-        for (auto &e : fs::recursive_directory_iterator(p)) {
-            try { if (fs::is_directory(e)) ++dirs; else if (fs::is_regular_file(e)) ++files; } catch(...) {}
-        }
-        cout << colorize(MTColor::CYAN, "files: ") << files << "    " << colorize(MTColor::CYAN, "dirs: ") << dirs << '\n';
-    } catch (const exception &ex) { eprint_colored(MTColor::RED, string("count: ") + ex.what() + '\n'); }
+    FileMeta root;
+    if (!stat_path(p, root) || root.type != FileType::Dir) { eprint_colored(MTColor::RED, "count: " + p + ": not a directory\n"); return; }
+    atomic<size_t> files{0}, dirs{0};
+    WalkOptions opt; opt.who = "count";
+    walk_tree(p, opt, [&](WalkDir &d) {
+        size_t f = 0, s = 0;
+        for (auto &e : d.entries) { if (e.type == FileType::Dir) ++s; else if (e.type == FileType::Regular) ++f; }
+        files += f; dirs += s;
+    });
+    cout << colorize(MTColor::CYAN, "files: ") << files << "    " << colorize(MTColor::CYAN, "dirs: ") << dirs << '\n';
 }
 
 static void cmd_alias(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "alias: usage alias name='command'\n"); return; }
     string s = a[1];
     auto pos = s.find('=');
     if (pos == string::npos) { eprint_colored(MTColor::YELLOW, "alias: need name=command\n"); return; }
@@ -608,7 +4070,6 @@ static void cmd_alias(const vector<string>& a) {
 }
 
 static void cmd_unalias(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "unalias: usage unalias name\n"); return; }
     auto it = alias_map.find(a[1]);
     if (it == alias_map.end()) { eprint_colored(MTColor::YELLOW, "unalias: not found\n"); return; }
     alias_map.erase(it);
@@ -644,7 +4105,6 @@ static void cmd_uptime(const vector<string>& a) {
 }
 
 static void cmd_ping(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "ping: missing host\n"); return; }
     string host = a[1];
     string cmd;
 #ifdef _WIN32
@@ -664,7 +4124,6 @@ static void cmd_ping(const vector<string>& a) {
 }
 
 static void cmd_hash(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "hash: missing file\n"); return; }
     string f = a[1];
 #ifdef _WIN32
     string cmd = "certutil -hashfile \"" + f + "\" SHA256";
@@ -684,7 +4143,6 @@ static void cmd_hash(const vector<string>& a) {
 }
 
 static void cmd_compress(const vector<string>& a) {
-    if (a.size() < 3) { eprint_colored(MTColor::YELLOW, "compress: usage compress <file/dir> <out.zip>\n"); return; }
     string src = a[1], out = a[2];
 #ifdef _WIN32
     string cmd = "tar -a -c -f \"" + out + "\" \"" + src + "\"";
@@ -696,7 +4154,6 @@ static void cmd_compress(const vector<string>& a) {
 }
 
 static void cmd_extract(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "extract: usage extract <archive>\n"); return; }
     string ar = a[1];
 #ifdef _WIN32
     string cmd = "tar -xf \"" + ar + "\"";
@@ -753,7 +4210,6 @@ static double parse_expression() {
 }
 
 static void cmd_calc(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "calc: usage calc \"expression\"\n"); return; }
     string expr = a[1];
     expr_ptr = expr.c_str();
     double res = parse_expression();
@@ -774,7 +4230,6 @@ static void cmd_random(const vector<string>& a) {
 // bookmarks + replace/edit/top/net/notify
 
 static void cmd_bookmark(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "bookmark: usage bookmark <name>\n"); return; }
     try {
         string cwd = fs::current_path().string();
         bookmarks[a[1]] = cwd;
@@ -788,20 +4243,17 @@ static void cmd_bookmarks(const vector<string>& a) {
 }
 
 static void cmd_unbookmark(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "unbookmark: usage unbookmark <name>\n"); return; }
     if (bookmarks.erase(a[1])) cout << "removed\n"; else eprint_colored(MTColor::YELLOW, "unbookmark: not found\n");
 }
 
 static void cmd_goto(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "goto: usage goto <name>\n"); return; }
     auto it = bookmarks.find(a[1]);
     if (it == bookmarks.end()) { eprint_colored(MTColor::YELLOW, "goto: not found\n"); return; }
-    try { fs::current_path(it->second); cout << "cwd -> " << colorize(MTColor::MINT_GREEN, it->second) << '\n'; }
+    try { fs::current_path(it->second); invalidate_prompt(); cout << "cwd -> " << colorize(MTColor::MINT_GREEN, it->second) << '\n'; }
     catch (const exception &ex) { eprint_colored(MTColor::RED, string("goto: ") + ex.what() + '\n'); }
 }
 
 static void cmd_replace(const vector<string>& a) {
-    if (a.size() < 4) { eprint_colored(MTColor::YELLOW, "replace: usage replace <file> <old> <new>\n"); return; }
     string file = a[1], oldv = a[2], newv = a[3];
     try {
         ifstream in(file);
@@ -843,7 +4295,6 @@ static void cmd_net(const vector<string>& a) {
 }
 
 static void cmd_notify(const vector<string>& a) {
-    if (a.size() < 2) { eprint_colored(MTColor::YELLOW, "notify: usage notify <message>\n"); return; }
     string msg = a[1];
 #ifdef _WIN32
     cout << "[notify] " << msg << '\n';
@@ -868,29 +4319,137 @@ static string substitute_aliases(const string &line) {
     return replaced;
 }
 
+static void cmd_exit(const vector<string>& a) { quit_requested = true; }
+
+// -- command registry ------------------------------------------------------
+// Every builtin is described once here: dispatch, arity checks and `help`
+// are all driven from this table.
+using CmdFn = void (*)(const vector<string>&);
+struct Command {
+    string_view name;
+    CmdFn fn;
+    size_t min_args;      // positional args required after the name
+    const char *usage;
+    const char *desc;     // nullptr hides the entry from help (aliases)
+};
+
+static void cmd_help(const vector<string>& a);
+
+static constexpr Command commands[] = {
+    { "help",       cmd_help,       0, "help",                       "this message" },
+    { "exit",       cmd_exit,       0, "exit, quit",                 "leave the terminal" },
+    { "quit",       cmd_exit,       0, "quit",                       nullptr },
+    { "ls",         cmd_ls,         0, "ls [-lStrU] [dir]",          "list directory (-l long, -S size, -t time, -r reverse, -U unsorted)" },
+    { "pwd",        cmd_pwd,        0, "pwd",                        "print working dir" },
+    { "cd",         cmd_cd,         1, "cd <dir>",                   "change dir" },
+    { "cat",        cmd_cat,        1, "cat <file>...",              "print files (raw bytes)" },
+    { "edit",       cmd_edit,       1, "edit <file>",                "open file with $EDITOR/code/nano" },
+    { "mkdir",      cmd_mkdir,      1, "mkdir [-p] <dir>",           "create directory" },
+    { "rm",         cmd_rm,         1, "rm [-rf] [--async] <path>...", "remove files (-r: trees, in parallel; -f: ignore missing)" },
+    { "rmdir",      cmd_rmdir,      1, "rmdir [--async|--status] <dir>", "remove directory tree (--async: in the background)" },
+    { "touch",      cmd_touch,      1, "touch <file>",               "create file if missing" },
+    { "cp",         cmd_cp,         2, "cp [-p] [--progress] <src> <dst>", "copy file or tree (-p: keep mode, owner, times)" },
+    { "mv",         cmd_mv,         2, "mv [--progress] <src> <dst>", "move / rename (copies across filesystems)" },
+    { "find",       cmd_find,       0, "find [-L] [dir] [tests]",    "list paths (-name -iname -type -size -mtime -mmin -newer -maxdepth -mindepth; -prune: don't descend into matches; -prune GLOB: skip dirs named GLOB)" },
+    { "echo",       cmd_echo,       0, "echo <text>",                "print text" },
+    { "history",    cmd_history,    0, "history [-c]",               "show (or clear) command history" },
+    { "grep",       cmd_grep,       2, "grep [-Er] <pat> <path>",    "search for pattern (-E: regex, -r: directory tree)" },
+    { "wc",         cmd_wc,         1, "wc [-lwc] <file>...",       "count lines/words/bytes" },
+    { "head",       cmd_head,       1, "head <file>",                "first 10 lines" },
+    { "tail",       cmd_tail,       1, "tail [-fF] [-n|-c N] <f>...", "last N lines / bytes (-f/-F: follow, Ctrl-C stops)" },
+    { "chmod",      cmd_chmod,      2, "chmod <octal> <file>",       "change permissions (e.g. 755)" },
+    { "ln",         cmd_ln,         2, "ln <target> <link>",         "create symbolic link" },
+    { "du",         cmd_du,         0, "du [-s|-d N] [--apparent] [--sort] [--cache] [dir]", "disk usage per directory (--sort: largest first)" },
+    { "sort",       cmd_sort,       1, "sort [-nru] [-k F[,L]] [-t C] [-S size] <file>", "sort lines by key (-S: memory budget, spills to disk)" },
+    { "uniq",       cmd_uniq,       1, "uniq [-c] [--all|--by-count] <file>", "drop adjacent duplicates (--all: anywhere; -c: counts)" },
+    { "tree",       cmd_tree,       0, "tree [-L N] [--du] [dir]",   "tree view (-L: depth, --du: sizes)" },
+    { "ps",         cmd_ps,         0, "ps",                         "process list" },
+    { "df",         cmd_df,         0, "df",                         "disk/free info" },
+    { "whoami",     cmd_whoami,     0, "whoami",                     "current user" },
+    { "date",       cmd_date,       0, "date",                       "show date/time" },
+    { "clear",      cmd_clear,      0, "clear",                      "clear screen" },
+    { "which",      cmd_which,      1, "which <cmd>",                "find executable in PATH" },
+    { "open",       cmd_open,       1, "open <file>",                "open with default application" },
+    { "env",        cmd_env,        0, "env",                        "show environment variables" },
+    { "setenv",     cmd_setenv,     2, "setenv NAME VALUE",          "set environment variable" },
+    { "stat",       cmd_stat,       1, "stat <file>",                "show file metadata" },
+    { "count",      cmd_count,      0, "count [dir]",                "count files and directories (recursive)" },
+    { "alias",      cmd_alias,      1, "alias name='command'",       "create alias" },
+    { "unalias",    cmd_unalias,    1, "unalias name",               "remove alias" },
+    { "aliases",    cmd_aliases,    0, "aliases",                    "list aliases" },
+    { "bookmark",   cmd_bookmark,   1, "bookmark <name>",            "save cwd under <name>" },
+    { "bookmarks",  cmd_bookmarks,  0, "bookmarks",                  "list bookmarks" },
+    { "unbookmark", cmd_unbookmark, 1, "unbookmark <name>",          "forget a bookmark" },
+    { "goto",       cmd_goto,       1, "goto <name>",                "cd to bookmark" },
+    { "replace",    cmd_replace,    3, "replace <file> <old> <new>", "in-file simple replace (creates .bak)" },
+    { "uptime",     cmd_uptime,     0, "uptime",                     "show system uptime" },
+    { "ping",       cmd_ping,       1, "ping <host> [-c N]",         "wrapper around system ping" },
+    { "hash",       cmd_hash,       1, "hash <file>",                "show SHA-256 (system tool)" },
+    { "compress",   cmd_compress,   2, "compress <file> <out.zip>",  "wrapper to create archive" },
+    { "extract",    cmd_extract,    1, "extract <archive>",          "extract archive (unzip/tar)" },
+    { "top",        cmd_top,        0, "top",                        "launch top/htop/taskmgr" },
+    { "net",        cmd_net,        0, "net",                        "show network interfaces (ip/ipconfig)" },
+    { "notify",     cmd_notify,     1, "notify <message>",           "desktop notification (Linux)" },
+    { "calc",       cmd_calc,       1, "calc \"expr\"",              "simple calculator (+ - * / parentheses)" },
+    { "random",     cmd_random,     0, "random [min] [max] [count]", "generate integers" },
+};
+
+// Open-addressing index over `commands`, built at compile time. A lookup is one
+// FNV-1a hash plus (almost always) a single probe, so external commands no
+// longer pay for a chain of failed string compares.
+class CommandIndex {
+    static constexpr size_t SLOTS = 256;  // power of two, well above 2x the table
+    int16_t slot_[SLOTS] = {};
+
+    static constexpr uint32_t hash(string_view s) {
+        uint32_t h = 2166136261u;
+        for (char c : s) { h ^= static_cast<unsigned char>(c); h *= 16777619u; }
+        return h;
+    }
+public:
+    constexpr CommandIndex() {
+        static_assert(sizeof(commands) / sizeof(commands[0]) * 2 < SLOTS, "grow CommandIndex::SLOTS");
+        for (auto &s : slot_) s = -1;
+        for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i) {
+            size_t h = hash(commands[i].name) & (SLOTS - 1);
+            while (slot_[h] >= 0) h = (h + 1) & (SLOTS - 1);
+            slot_[h] = static_cast<int16_t>(i);
+        }
+    }
+    const Command *find(string_view name) const {
+        for (size_t h = hash(name) & (SLOTS - 1); slot_[h] >= 0; h = (h + 1) & (SLOTS - 1))
+            if (commands[slot_[h]].name == name) return &commands[slot_[h]];
+        return nullptr;
+    }
+};
+static constexpr CommandIndex command_index;
+
+static void cmd_help(const vector<string>& a) {
+    print_colored(MTColor::CYAN, "Commands (Mint look):\n");
+    // the usage column fits the longest entry up to a cap; longer ones get a line of their own
+    constexpr int max_width = 32;
+    int width = 0;
+    for (auto &c : commands) if (c.desc) width = max(width, min(max_width, static_cast<int>(strlen(c.usage))));
+    for (auto &c : commands) {
+        if (!c.desc) continue;
+        if (static_cast<int>(strlen(c.usage)) > width) cout << "  " << c.usage << '\n' << string(width + 3, ' ');
+        else cout << "  " << left << setw(width + 1) << c.usage;
+        cout << "- " << c.desc << '\n';
+    }
+    cout << right;
+}
+
 // -- main loop ---------------------------------------------------------
 int main() {
     enable_ansi_on_windows();
+    ios::sync_with_stdio(false);
+    color_stdout = fd_is_tty(1);
+    color_stderr = fd_is_tty(2);
     cout << colorize(MTColor::MINT_GREEN, "Tiny Minty Terminal") << " (" << PLATFORM << ") - type 'help'\n";
     string line;
     while (true) {
-        try {
-            string path = fs::current_path().string();
-            const char* user = getenv("USER");
-            string userstr = user ? user : "user";
-            char hostbuf[256] = {0};
-#ifdef _WIN32
-            DWORD len = sizeof(hostbuf);
-            if (!GetComputerNameA(hostbuf, &len)) hostbuf[0] = '\0';
-#else
-            if (gethostname(hostbuf, sizeof(hostbuf)) != 0) hostbuf[0] = '\0';
-#endif
-            cout << colorize(MTColor::MINT_GREEN, userstr + "@" + string(hostbuf)) << ":" << colorize(MTColor::CYAN, path)
-                 << " " << mt_code(MTColor::BOLD) << colorize(MTColor::BRIGHT_GREEN, "> ") << mt_code(MTColor::RESET);
-        } catch(...) {
-            cout << colorize(MTColor::BRIGHT_GREEN, "> ");
-        }
-
+        bg_removals.print_notices();
+        cout << render_prompt();
         if (!getline(cin, line)) break;
         if (line.empty()) continue;
         line = substitute_aliases(line);
@@ -900,64 +4459,12 @@ int main() {
         if (args.empty()) continue;
         const string &cmd = args[0];
 
-        if (cmd == "exit" || cmd == "quit") break;
-        else if (cmd == "help") cmd_help();
-        else if (cmd == "ls") cmd_ls(args);
-        else if (cmd == "pwd") cmd_pwd();
-        else if (cmd == "cd") cmd_cd(args);
-        else if (cmd == "cat") cmd_cat(args);
-        else if (cmd == "edit") cmd_edit(args);
-        else if (cmd == "mkdir") cmd_mkdir(args);
-        else if (cmd == "rm") cmd_rm(args);
-        else if (cmd == "rmdir") cmd_rmdir(args);
-        else if (cmd == "touch") cmd_touch(args);
-        else if (cmd == "cp") cmd_cp(args);
-        else if (cmd == "mv") cmd_mv(args);
-        else if (cmd == "find") cmd_find(args);
-        else if (cmd == "tree") cmd_tree(args);
-        else if (cmd == "ps") cmd_ps(args);
-        else if (cmd == "df") cmd_df(args);
-        else if (cmd == "whoami") cmd_whoami(args);
-        else if (cmd == "date") cmd_date(args);
-        else if (cmd == "clear") cmd_clear(args);
-        else if (cmd == "echo") cmd_echo(args);
-        else if (cmd == "grep") cmd_grep(args);
-        else if (cmd == "wc") cmd_wc(args);
-        else if (cmd == "head") cmd_head(args);
-        else if (cmd == "tail") {
-            if (args.size() > 1 && args[1] == "-f") cmd_tailf(args);
-            else cmd_tail(args);
-        }
-        else if (cmd == "chmod") cmd_chmod(args);
-        else if (cmd == "ln") cmd_ln(args);
-        else if (cmd == "du") cmd_du(args);
-        else if (cmd == "sort") cmd_sort(args);
-        else if (cmd == "uniq") cmd_uniq(args);
-        else if (cmd == "history") cmd_history(args);
-        else if (cmd == "which") cmd_which(args);
-        else if (cmd == "open") cmd_open(args);
-        else if (cmd == "env") cmd_env(args);
-        else if (cmd == "setenv") cmd_setenv(args);
-        else if (cmd == "stat") cmd_stat(args);
-        else if (cmd == "count") cmd_count(args);
-        else if (cmd == "alias") cmd_alias(args);
-        else if (cmd == "unalias") cmd_unalias(args);
-        else if (cmd == "aliases") cmd_aliases(args);
-        else if (cmd == "uptime") cmd_uptime(args);
-        else if (cmd == "ping") cmd_ping(args);
-        else if (cmd == "hash") cmd_hash(args);
-        else if (cmd == "compress") cmd_compress(args);
-        else if (cmd == "extract") cmd_extract(args);
-        else if (cmd == "calc") cmd_calc(args);
-        else if (cmd == "random") cmd_random(args);
-        else if (cmd == "bookmark") cmd_bookmark(args);
-        else if (cmd == "bookmarks") cmd_bookmarks(args);
-        else if (cmd == "unbookmark") cmd_unbookmark(args);
-        else if (cmd == "goto") cmd_goto(args);
-        else if (cmd == "replace") cmd_replace(args);
-        else if (cmd == "top") cmd_top(args);
-        else if (cmd == "net") cmd_net(args);
-        else if (cmd == "notify") cmd_notify(args);
+        if (const Command *c = command_index.find(cmd)) {
+            if (args.size() - 1 < c->min_args) eprint_colored(MTColor::YELLOW, string(c->name) + ": usage " + c->usage + "\n");
+            else c->fn(args);
+            out.flush();
+            if (quit_requested) break;
+        }
         else {
             FILE *p = popen(line.c_str(), "r");
             if (!p) { eprint_colored(MTColor::RED, string("failed to run: ") + line + '\n'); continue; }
@@ -967,6 +4474,7 @@ int main() {
         }
     }
 
+    bg_removals.join_all();
     cout << colorize(MTColor::GRAY, "Bye\n");
     return 0;
 }